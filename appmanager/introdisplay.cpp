@@ -104,14 +104,15 @@ void IntroDisplay::populate()
     {
         QListWidgetItem *item = new QListWidgetItem(listRated);
         QIcon ico;
+        QPixmap icon = win->packageIcon(rated.inf);
         
-        if (rated.inf.icon.isNull())
+        if (icon.isNull())
         {
             ico = QIcon(":/images/package.png");
         }
         else
         {
-            ico = QIcon(rated.inf.icon);
+            ico = QIcon(icon);
         }
         
         item->setIcon(ico);
@@ -38,6 +38,7 @@
 #include <packagemetadata.h>
 #include <databasereader.h>
 #include <databasepackage.h>
+#include <databaseformat.h>
 
 #include <QIcon>
 #include <QVBoxLayout>
@@ -47,14 +48,29 @@
 #include <QDate>
 #include <QTimer>
 #include <QDir>
+#include <QFile>
+#include <QLocale>
 #include <QScrollArea>
 
 #include <QtXml>
 #include <QCheckBox>
 
+#include <string.h>
+
 using namespace LogramUi;
 using namespace Logram;
 
+// Chaîne de la zone de données d'un fichier .mdcache, 0 si elle sort du fichier
+static const char *metadataString(const char *data, qint64 size, int32_t ptr)
+{
+    if (ptr < 0 || ptr >= size || memchr(data + ptr, 0, size - ptr) == 0)
+    {
+        return 0;
+    }
+    
+    return data + ptr;
+}
+
 MainWindow::MainWindow() : QMainWindow(0)
 {
     _error = false;
@@ -170,6 +186,8 @@ MainWindow::~MainWindow()
     delete listPackages;
     delete ps;
     delete progressDialog;
+    
+    qDeleteAll(metadataFiles);
 }
 
 bool MainWindow::error() const
@@ -315,7 +333,12 @@ QVector<DatabasePackage *> MainWindow::packages(bool &expandable)
     }
     
     // Trouver les IDs en fonction de ce qu'on demande
-    if (regex.isEmpty())
+    if (regex.isEmpty() && (filter == FilterInterface::Installed || filter == FilterInterface::NotInstalled))
+    {
+        // Seulement les paquets installés ou non, la base de donnée les trouve directement
+        ids = dr->packagesWithFlags(Package::Installed, (filter == FilterInterface::Installed ? Package::Installed : 0));
+    }
+    else if (regex.isEmpty())
     {
         // Tous les paquets
         int tot = ps->packages();
@@ -523,72 +546,118 @@ void MainWindow::readPackages()
 {
     PackageInfo pkg;
     
+    // Oublier les anciennes métadonnées, les fichiers ont pu changer
+    packageInfos.clear();
+    highestRated.clear();
+    icons.clear();
+    
+    qDeleteAll(metadataFiles);
+    metadataFiles.clear();
+    
     QDir dir(ps->varRoot() + "/var/cache/lgrpkg/db");
     QStringList files = dir.entryList(QDir::Files);
+    QString userLang = QLocale::system().name().section("_", 0, 0);
     
     float minRated = 0.0;
     
     foreach (const QString &file, files)
     {
-        if (!file.endsWith(".metadata")) continue;
+        if (!file.endsWith(".mdcache")) continue;
         
         QString filename = dir.absoluteFilePath(file);
         QStringList parts = file.split('_');
         QString repo = parts.at(0);
         QString distro = parts.at(1).section('.', 0, 0);
         
-        // Ouvrir le fichier
-        QFile fl(filename);
+        // Mapper le fichier compilé par DatabaseWriter::rebuild()
+        QFile *fl = new QFile(filename);
+        uchar *map;
         
-        if (!fl.open(QIODevice::ReadOnly))
+        if (!fl->open(QIODevice::ReadOnly) ||
+            fl->size() < (qint64)sizeof(_MetadataCache) ||
+            (map = fl->map(0, fl->size())) == 0)
         {
+            delete fl;
             continue;
         }
         
-        // Lire le contenu
-        QDomDocument doc;
-        doc.setContent(fl.readAll());
-        QDomElement package = doc.documentElement().firstChildElement();
+        metadataFiles.append(fl);
         
-        while (!package.isNull())
+        const _MetadataCache *header = (const _MetadataCache *)map;
+        qint64 size = fl->size() - sizeof(_MetadataCache);
+        
+        // Fichier d'un autre format, ou tronqué
+        if (header->version != DATABASE_METADATA_VERSION ||
+            header->count < 0 ||
+            header->count > size / (qint64)sizeof(_MetadataPackage))
         {
-            QString key = repo + "/" + distro + "/" + package.attribute("name");
-            QString primarylang = package.attribute("primarylang");
+            continue;
+        }
+        
+        const _MetadataPackage *packages = (const _MetadataPackage *)(map + sizeof(_MetadataCache));
+        const char *data = (const char *)(packages + header->count);
+        
+        // Taille de la zone de données, les pointeurs ne doivent pas en sortir
+        size -= header->count * sizeof(_MetadataPackage);
+        
+        for (int index=0; index<header->count; ++index)
+        {
+            const _MetadataPackage &package = packages[index];
+            const char *name = metadataString(data, size, package.name_ptr);
+            const char *primarylang = metadataString(data, size, package.primarylang_ptr);
+            
+            if (name == 0)
+            {
+                continue;
+            }
+            
+            QString key = repo + "/" + distro + "/" + QString::fromUtf8(name);
             
-            pkg.title = PackageMetaData::stringOfKey(package.firstChildElement("title"), primarylang);
-            pkg.votes = package.attribute("votes").toInt();
-            pkg.total_votes = package.attribute("totalvotes").toInt();
+            // Titre dans la langue de l'utilisateur, sinon celle du paquet, sinon le premier
+            const _MetadataTitle *titles = (const _MetadataTitle *)(data + package.titles_ptr);
+            const char *title = 0;
+            int titles_count = package.titles_count;
             
-            // Trouver l'icône
-            QDomElement iconElement = package.firstChildElement("icon");
-            QByteArray iconData;
+            if (package.titles_ptr < 0 || titles_count < 0 ||
+                package.titles_ptr + (qint64)titles_count * (qint64)sizeof(_MetadataTitle) > size)
+            {
+                titles_count = 0;
+            }
             
-            if (!iconElement.isNull())
+            for (int j=0; j<titles_count; ++j)
             {
-                // Trouver le noeud CDATA
-                QDomNode node = iconElement.firstChild();
-                QDomCDATASection section;
+                const char *lang = metadataString(data, size, titles[j].lang_ptr);
+                const char *ttitle = metadataString(data, size, titles[j].title_ptr);
                 
-                while (!node.isNull())
+                if (lang == 0 || ttitle == 0)
                 {
-                    if (node.isCDATASection())
-                    {
-                        section = node.toCDATASection();
-                        break;
-                    }
-                    
-                    node = node.nextSibling();
+                    continue;
                 }
                 
-                if (!section.isNull())
+                if (userLang == QLatin1String(lang))
+                {
+                    title = ttitle;
+                    break;
+                }
+                else if (title == 0 || (primarylang != 0 && qstrcmp(lang, primarylang) == 0))
                 {
-                    iconData = QByteArray::fromBase64(section.data().toAscii());
+                    title = ttitle;
                 }
             }
             
-            if (!iconData.isNull())
+            pkg.title = (title == 0 ? QString() : QString::fromUtf8(title));
+            pkg.votes = package.votes;
+            pkg.total_votes = package.total_votes;
+            
+            // L'icône n'est décodée que lorsqu'elle est affichée
+            if (package.icon_size > 0 && package.icon_ptr >= 0 &&
+                package.icon_ptr + (qint64)package.icon_size <= size)
+            {
+                pkg.iconData = QByteArray::fromRawData(data + package.icon_ptr, package.icon_size);
+            }
+            else
             {
-                pkg.icon = Utils::pixmapFromData(iconData, 32, 32);
+                pkg.iconData = QByteArray();
             }
             
             // Insérer dans la liste globale
@@ -645,12 +714,30 @@ void MainWindow::readPackages()
                     minRated = score;
                 }
             }
-            
-            package = package.nextSiblingElement();
         }
     }
 }
 
+QPixmap MainWindow::packageIcon(const PackageInfo &inf) const
+{
+    if (inf.iconData.isEmpty())
+    {
+        return QPixmap();
+    }
+    
+    QHash<const char *, QPixmap>::const_iterator it = icons.constFind(inf.iconData.constData());
+    
+    if (it != icons.constEnd())
+    {
+        return it.value();
+    }
+    
+    QPixmap icon = Utils::pixmapFromData(inf.iconData, 32, 32);
+    icons.insert(inf.iconData.constData(), icon);
+    
+    return icon;
+}
+
 void MainWindow::updateDatabase()
 {
     // On met à jour la base de donnée binaire
@@ -50,6 +50,7 @@ class Breadcrumb;
 class PackageDisplay;
 
 class QListWidget;
+class QFile;
 
 class MainWindow : public QMainWindow, public Ui_MainWindow
 {
@@ -62,7 +63,7 @@ class MainWindow : public QMainWindow, public Ui_MainWindow
         
         struct PackageInfo
         {
-            QPixmap icon;
+            QByteArray iconData;    // Pointe dans le fichier .mdcache, voir packageIcon()
             QString title;
             int votes, total_votes;
         };
@@ -76,6 +77,7 @@ class MainWindow : public QMainWindow, public Ui_MainWindow
         
         QVector<RatedPackage> &ratedPackages();
         const PackageInfo packageInfo(Logram::DatabasePackage *pkg) const;
+        QPixmap packageIcon(const PackageInfo &inf) const;
         static int bestPackageIndex(const QVector<Logram::DatabasePackage *> &packages, Logram::DatabasePackage *ref = 0);
         
     private slots:
@@ -112,6 +114,8 @@ class MainWindow : public QMainWindow, public Ui_MainWindow
         Breadcrumb *breadcrumb;
         
         QHash<QString, PackageInfo> packageInfos;
+        QList<QFile *> metadataFiles;
+        mutable QHash<const char *, QPixmap> icons;
         QVector<RatedPackage> highestRated;
         QHash<Logram::DatabasePackage *, int> packageActions;
         
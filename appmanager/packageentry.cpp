@@ -88,7 +88,7 @@ void Entry::setCurrentPackage(int index)
     MainWindow::PackageInfo inf = win->packageInfo(curpkg);
     
     // Icône du paquet
-    baseIcon = inf.icon;
+    baseIcon = win->packageIcon(inf);
     
     if (baseIcon.isNull())
     {
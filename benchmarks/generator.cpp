@@ -0,0 +1,255 @@
+/*
+ * generator.cpp
+ * This file is part of Logram
+ *
+ * Copyright (C) 2009, 2010 - Denis Steckelmacher <steckdenis@logram-project.org>
+ *
+ * Logram is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Logram is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "generator.h"
+
+#include <package.h>
+
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QSettings>
+
+#include <stdlib.h>
+
+#define HASH "0123456789abcdef0123456789abcdef01234567"
+
+using namespace Logram;
+
+RepositoryGenerator::RepositoryGenerator(const QString &root)
+{
+    _root = root;
+    _packages = 5000;
+    _fanout = 4;
+    _files = 10;
+    _seed = 42;
+    _listsSize = 0;
+}
+
+void RepositoryGenerator::setPackages(int count)
+{
+    _packages = qMax(2, count);
+}
+
+void RepositoryGenerator::setFanout(int fanout)
+{
+    _fanout = qMax(0, fanout);
+}
+
+void RepositoryGenerator::setFiles(int files)
+{
+    _files = qMax(0, files);
+}
+
+void RepositoryGenerator::setSeed(uint seed)
+{
+    _seed = seed;
+}
+
+int RepositoryGenerator::packages() const
+{
+    return _packages;
+}
+
+int RepositoryGenerator::fanout() const
+{
+    return _fanout;
+}
+
+int RepositoryGenerator::files() const
+{
+    return _files;
+}
+
+qint64 RepositoryGenerator::listsSize() const
+{
+    return _listsSize;
+}
+
+QString RepositoryGenerator::lastError() const
+{
+    return _error;
+}
+
+QString RepositoryGenerator::installedPackage() const
+{
+    // Le dernier paquet est une feuille du graphe, dont dépendent beaucoup de paquets installés
+    return QString("pkg%1").arg(_packages - 1);
+}
+
+QString RepositoryGenerator::upgradablePackage() const
+{
+    // Premier multiple de 10 dans la moitié installée
+    int index = ((_packages / 2 + 9) / 10) * 10;
+    
+    if (index >= _packages) index = _packages / 2;
+    
+    return QString("pkg%1=1.1").arg(index);
+}
+
+bool RepositoryGenerator::writeCompressed(const QString &fileName, const QByteArray &data)
+{
+    QProcess xz;
+    
+    xz.setStandardOutputFile(fileName);
+    xz.start("xz", QStringList() << "-c" << "-1");
+    
+    if (!xz.waitForStarted())
+    {
+        _error = "Unable to start xz";
+        return false;
+    }
+    
+    xz.write(data);
+    xz.closeWriteChannel();
+    
+    if (!xz.waitForFinished(-1) || xz.exitCode() != 0)
+    {
+        _error = "Unable to compress " + fileName;
+        return false;
+    }
+    
+    _listsSize += data.size();
+    
+    return true;
+}
+
+bool RepositoryGenerator::generate()
+{
+    QString path = _root + "/mirror/dists/bench/i686";
+    
+    if (!QDir().mkpath(path) ||
+        !QDir().mkpath(_root + "/etc/lgrpkg/scripts") ||
+        !QDir().mkpath(_root + "/var/cache/lgrpkg/db") ||
+        !QDir().mkpath(_root + "/var/cache/lgrpkg/download"))
+    {
+        _error = "Unable to create the directories in " + _root;
+        return false;
+    }
+    
+    srand(_seed);
+    
+    QByteArray packagesList, translations, filesList;
+    int firstInstalled = _packages / 2;
+    
+    filesList += ":usr\n:share\n:bench\n";
+    
+    for (int i=0; i<_packages; ++i)
+    {
+        QByteArray name = "pkg" + QByteArray::number(i);
+        bool installed = (i >= firstInstalled);
+        bool upgradable = (installed && (i % 10) == 0);
+        
+        // Dépendances vers des paquets d'index plus élevé, une sur deux versionnée
+        QByteArray depends;
+        
+        for (int j=0; j<_fanout && i < _packages - 1; ++j)
+        {
+            int dep = i + 1 + (rand() % (_packages - i - 1));
+            
+            if (!depends.isEmpty()) depends += "; ";
+            
+            depends += "pkg" + QByteArray::number(dep);
+            
+            if (j % 2 == 1) depends += ">=1.0";
+        }
+        
+        // Une ou deux versions
+        for (int v=0; v<(upgradable ? 2 : 1); ++v)
+        {
+            int flags = Package::Primary;
+            
+            if (installed && v == 0) flags |= Package::Installed;
+            
+            packagesList += "[" + name + "]\n";
+            packagesList += "Name=" + name + "\n";
+            packagesList += "Version=" + QByteArray(v == 0 ? "1.0" : "1.1") + "\n";
+            packagesList += "Source=" + name + "\n";
+            packagesList += "Maintainer=Benchmark <bench@logram-project.org>\n";
+            packagesList += "Distribution=bench\n";
+            packagesList += "Section=bench\n";
+            packagesList += "UpstreamUrl=http://logram-project.org\n";
+            packagesList += "License=GPLv3\n";
+            packagesList += "Arch=i686\n";
+            packagesList += "PackageHash=" HASH "\n";
+            packagesList += "MetadataHash=" HASH "\n";
+            packagesList += "DownloadSize=" + QByteArray::number(1024 + rand() % (1024 * 1024)) + "\n";
+            packagesList += "InstallSize=" + QByteArray::number(4096 + rand() % (4 * 1024 * 1024)) + "\n";
+            packagesList += "Flags=" + QByteArray::number(flags) + "\n";
+            packagesList += "Depends=" + depends + "\n\n";
+        }
+        
+        translations += name + ":Synthetic package " + name + "\n";
+        
+        // Fichiers : /usr/share/bench/<paquet>/file<n>
+        if (_files != 0)
+        {
+            filesList += ":" + name + "\n";
+            
+            for (int f=0; f<_files; ++f)
+            {
+                filesList += name + "|0|0|file" + QByteArray::number(f) + "\n";
+            }
+            
+            filesList += "::\n";
+        }
+    }
+    
+    if (!writeCompressed(path + "/packages.xz", packagesList) ||
+        !writeCompressed(path + "/translate.fr.xz", translations) ||
+        !writeCompressed(path + "/files.xz", filesList))
+    {
+        return false;
+    }
+    
+    // Configuration
+    QSettings set(_root + "/etc/lgrpkg/sources.list", QSettings::IniFormat);
+    
+    set.clear();
+    set.setValue("Language", "fr");
+    set.beginGroup("bench");
+    set.setValue("Type", "local");
+    set.setValue("Mirrors", _root + "/mirror");
+    set.setValue("Distributions", "bench");
+    set.setValue("Archs", "i686");
+    set.setValue("Active", true);
+    set.setValue("Sign", false);
+    set.setValue("Description", "Synthetic benchmark repository");
+    set.endGroup();
+    set.sync();
+    
+    // Même politique de pesage que celle installée
+    QFile weight(_root + "/etc/lgrpkg/scripts/weight.conf");
+    
+    if (!weight.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        _error = "Unable to write " + weight.fileName();
+        return false;
+    }
+    
+    weight.write("[Install]\nBase=20\nDownloadUnit=102400\nInstallUnit=1048576\n\n"
+                 "[Remove]\nBase=30\nInstallUnit=1048576\n\n"
+                 "[Purge]\nBase=30\nInstallUnit=1048576\n\n"
+                 "[Update]\nBase=10\nDownloadUnit=102400\n");
+    
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * generator.h
+ * This file is part of Logram
+ *
+ * Copyright (C) 2009, 2010 - Denis Steckelmacher <steckdenis@logram-project.org>
+ *
+ * Logram is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Logram is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GENERATOR_H__
+#define __GENERATOR_H__
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief Générateur de dépôt synthétique
+ * 
+ * Crée dans un dossier racine un mirroir local (packages.xz, translate.fr.xz,
+ * files.xz) et le sources.list qui le référence, de façon à pouvoir
+ * reconstruire la base de donnée avec PackageSystem::update().
+ * 
+ * Les paquets s'appellent pkg0 à pkgN-1. Chaque paquet dépend de paquets
+ * d'index plus élevés, ce qui donne un graphe sans cycles dont pkg0 est la
+ * racine. La seconde moitié des paquets est installée, et un paquet installé
+ * sur dix a une nouvelle version disponible.
+ */
+class RepositoryGenerator
+{
+    public:
+        RepositoryGenerator(const QString &root);
+        
+        void setPackages(int count);        /*!< @brief Nombre de paquets (5000 par défaut) */
+        void setFanout(int fanout);         /*!< @brief Nombre de dépendances par paquet (4 par défaut) */
+        void setFiles(int files);           /*!< @brief Nombre de fichiers par paquet (10 par défaut) */
+        void setSeed(uint seed);            /*!< @brief Graine du générateur aléatoire, pour des dépôts reproductibles */
+        
+        int packages() const;
+        int fanout() const;
+        int files() const;
+        qint64 listsSize() const;           /*!< @brief Taille décompressée des listes générées, en octets */
+        
+        /**
+         * @brief Crée le dépôt et la configuration
+         * @return True si tout s'est bien passé, false sinon (erreur dans lastError())
+         */
+        bool generate();
+        
+        QString lastError() const;
+        
+        QString installedPackage() const;   /*!< @brief Paquet installé dont beaucoup d'autres dépendent */
+        QString upgradablePackage() const;  /*!< @brief Paquet installé ayant une nouvelle version */
+        
+    private:
+        bool writeCompressed(const QString &fileName, const QByteArray &data);
+        
+        QString _root, _error;
+        int _packages, _fanout, _files;
+        qint64 _listsSize;
+        uint _seed;
+};
+
+#endif
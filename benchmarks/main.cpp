@@ -0,0 +1,394 @@
+/*
+ * main.cpp
+ * This file is part of Logram
+ *
+ * Copyright (C) 2009, 2010 - Denis Steckelmacher <steckdenis@logram-project.org>
+ *
+ * Logram is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Logram is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Logram; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/*
+ * lgrbench : mesures de performances de libpackage sur un dépôt synthétique.
+ * 
+ * Chaque mesure est écrite sur une ligne "nom valeur unité", facile à comparer
+ * d'une version à l'autre.
+ */
+
+#include "generator.h"
+
+#include <packagesystem.h>
+#include <packagelist.h>
+#include <solver.h>
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QVector>
+#include <QTime>
+#include <QFile>
+#include <QDir>
+#include <QTextStream>
+#include <QProcess>
+
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace Logram;
+using namespace std;
+
+static QTextStream *output = 0;
+static bool echo = false;       // Recopier les résultats sur la sortie standard
+
+// Reçoit les résultats des boucles mesurées, pour que le compilateur ne les supprime pas
+static volatile int sink = 0;
+
+static void result(const QString &name, double value, const QString &unit)
+{
+    QString line = QString("%1 %2 %3").arg(name).arg(value, 0, 'f', 3).arg(unit);
+    
+    *output << line << '\n';
+    output->flush();
+    
+    if (echo)
+    {
+        cout << qPrintable(line) << endl;
+    }
+}
+
+static int peakMemory()
+{
+    // Pic de mémoire résidente du processus, en Kio
+    QFile fl("/proc/self/status");
+    
+    if (!fl.open(QIODevice::ReadOnly))
+    {
+        return -1;
+    }
+    
+    while (!fl.atEnd())
+    {
+        QByteArray line = fl.readLine();
+        
+        if (line.startsWith("VmHWM:"))
+        {
+            return line.mid(6).trimmed().split(' ').at(0).toInt();
+        }
+    }
+    
+    return -1;
+}
+
+static void benchVersions(int iterations)
+{
+    // Paires de versions variées, comparées en boucle
+    QVector<QByteArray> versions;
+    
+    for (int i=0; i<1000; ++i)
+    {
+        versions.append(QByteArray::number(rand() % 10) + '.' + QByteArray::number(rand() % 20) + 
+                        (rand() % 2 ? "~" + QByteArray::number(rand() % 5) : QByteArray("alpha") + QByteArray::number(rand() % 3)));
+    }
+    
+    int count = iterations * 100000;
+    int sum = 0;
+    QTime time;
+    
+    time.start();
+    
+    for (int i=0; i<count; ++i)
+    {
+        sum += PackageSystem::compareVersions(versions.at(i % 1000).constData(), versions.at((i * 7 + 3) % 1000).constData());
+    }
+    
+    int elapsed = time.elapsed();
+    
+    result("versions.compare", (elapsed * 1000000.0) / count, "ns/op");
+    
+    sink = sum;
+}
+
+static bool benchRebuild(PackageSystem *ps, qint64 listsSize, int iterations)
+{
+    int total = 0;
+    
+    for (int i=0; i<iterations; ++i)
+    {
+        QTime time;
+        time.start();
+        
+        if (!ps->update(PackageSystem::Minimal))
+        {
+            return false;
+        }
+        
+        total += time.elapsed();
+    }
+    
+    result("database.rebuild", (double)total / iterations, "ms");
+    
+    // Débit de lecture des listes décompressées
+    if (total > 0)
+    {
+        result("database.rebuild.throughput", (listsSize * iterations / 1048576.0) / (total / 1000.0), "MiB/s");
+    }
+    
+    return true;
+}
+
+static void benchLookups(PackageSystem *ps, int packages, int iterations)
+{
+    int count = iterations * 2000;
+    int found = 0;
+    QTime time;
+    
+    time.start();
+    
+    for (int i=0; i<count; ++i)
+    {
+        QString name = QString("pkg%1").arg(rand() % packages);
+        
+        found += ps->packagesByVString(name, QString(), Depend::NoVersion).count();
+    }
+    
+    result("database.lookup", (time.elapsed() * 1000.0) / count, "us/op");
+    
+    sink = found;
+}
+
+static bool solve(PackageSystem *ps, const QString &pattern, Solver::Action action, bool useCache, int &elapsed, int &packages)
+{
+    QTime time;
+    time.start();
+    
+    Solver *solver = ps->newSolver();
+    solver->setUseCache(useCache);
+    solver->addPackage(pattern, action);
+    
+    bool ended = true;
+    
+    if (!solver->solve() || !solver->weight() || !solver->beginList(ended))
+    {
+        delete solver;
+        return false;
+    }
+    
+    // Toujours prendre le premier choix, en limitant le nombre de choix
+    for (int i=0; !ended && i<10000; ++i)
+    {
+        if (!solver->continueList(0, ended))
+        {
+            delete solver;
+            return false;
+        }
+    }
+    
+    PackageList *list = solver->list();
+    
+    packages = list->count();
+    elapsed = time.elapsed();
+    
+    delete list;
+    delete solver;
+    
+    return true;
+}
+
+static void benchSolve(PackageSystem *ps, const QString &name, const QString &pattern, Solver::Action action, bool useCache, int iterations)
+{
+    int total = 0, packages = 0;
+    
+    for (int i=0; i<iterations; ++i)
+    {
+        int elapsed;
+        
+        if (!solve(ps, pattern, action, useCache, elapsed, packages))
+        {
+            cerr << "Unable to solve " << qPrintable(name) << endl;
+            return;
+        }
+        
+        total += elapsed;
+    }
+    
+    result(name, (double)total / iterations, "ms");
+    result(name + ".packages", packages, "packages");
+}
+
+static void usage()
+{
+    cout << "Usage: lgrbench [options]" << endl
+         << "  --packages <n>    Number of synthetic packages (5000)" << endl
+         << "  --fanout <n>      Dependencies per package (4)" << endl
+         << "  --files <n>       Files per package (10)" << endl
+         << "  --iterations <n>  Runs of each measure (3)" << endl
+         << "  --seed <n>        Random seed (42)" << endl
+         << "  --root <dir>      Directory of the synthetic repository (temporary)" << endl
+         << "  --output <file>   Write the results to <file> instead of stdout" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    
+    QString root = QDir::tempPath() + QString("/lgrbench-%1").arg(getpid());
+    QString outputFile;
+    int packages = -1, fanout = -1, files = -1;
+    int iterations = 3;
+    uint seed = 42;
+    bool tempRoot = true;
+    
+    for (int i=1; i<args.count(); ++i)
+    {
+        const QString &opt = args.at(i);
+        
+        if (i + 1 >= args.count())
+        {
+            usage();
+            return 1;
+        }
+        
+        QString value = args.at(++i);
+        
+        if (opt == "--packages")
+        {
+            packages = value.toInt();
+        }
+        else if (opt == "--fanout")
+        {
+            fanout = value.toInt();
+        }
+        else if (opt == "--files")
+        {
+            files = value.toInt();
+        }
+        else if (opt == "--iterations")
+        {
+            iterations = qMax(1, value.toInt());
+        }
+        else if (opt == "--seed")
+        {
+            seed = value.toUInt();
+        }
+        else if (opt == "--root")
+        {
+            root = value;
+            tempRoot = false;
+        }
+        else if (opt == "--output")
+        {
+            outputFile = value;
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    
+    // Sortie des résultats
+    QFile out;
+    
+    if (outputFile.isEmpty())
+    {
+        out.open(stdout, QIODevice::WriteOnly);
+    }
+    else
+    {
+        out.setFileName(outputFile);
+        echo = true;
+        
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            cerr << "Unable to open " << qPrintable(outputFile) << endl;
+            return 1;
+        }
+    }
+    
+    QTextStream stream(&out);
+    output = &stream;
+    
+    // Dépôt synthétique
+    RepositoryGenerator gen(root);
+    
+    if (packages != -1) gen.setPackages(packages);
+    if (fanout != -1) gen.setFanout(fanout);
+    if (files != -1) gen.setFiles(files);
+    gen.setSeed(seed);
+    
+    QTime time;
+    time.start();
+    
+    if (!gen.generate())
+    {
+        cerr << qPrintable(gen.lastError()) << endl;
+        return 1;
+    }
+    
+    result("config.packages", gen.packages(), "packages");
+    result("config.fanout", gen.fanout(), "deps");
+    result("config.files", gen.files(), "files");
+    result("generate", time.elapsed(), "ms");
+    
+    srand(seed);
+    
+    // Micro-benchmarks
+    benchVersions(iterations);
+    
+    // Base de donnée
+    PackageSystem *ps = new PackageSystem;
+    
+    ps->setInstallRoot(root);
+    ps->setConfRoot(root);
+    ps->setVarRoot(root);
+    ps->setRunTriggers(false);
+    ps->loadConfig();
+    
+    if (!benchRebuild(ps, gen.listsSize(), iterations))
+    {
+        cerr << "Unable to rebuild the database" << endl;
+        return 1;
+    }
+    
+    time.start();
+    
+    if (!ps->init())
+    {
+        cerr << "Unable to read the database" << endl;
+        return 1;
+    }
+    
+    result("database.init", time.elapsed(), "ms");
+    
+    benchLookups(ps, gen.packages(), iterations);
+    
+    // Solveur
+    benchSolve(ps, "solve.install", "pkg0", Solver::Install, false, iterations);
+    benchSolve(ps, "solve.install.cached", "pkg0", Solver::Install, true, iterations);
+    benchSolve(ps, "solve.remove", gen.installedPackage(), Solver::Remove, false, iterations);
+    benchSolve(ps, "solve.upgrade", gen.upgradablePackage(), Solver::Install, false, iterations);
+    
+    result("memory.peak", peakMemory(), "KiB");
+    
+    delete ps;
+    
+    if (tempRoot)
+    {
+        QProcess::execute("rm", QStringList() << "-rf" << root);
+    }
+    
+    return 0;
+}
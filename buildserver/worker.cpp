@@ -353,25 +353,28 @@ bool Worker::prepareTemp()
     
     sourcesList.sync();
     
-    // weight.qs
-    QFile in(":weight.qs");
-    QFile out(tmpRoot + "/etc/lgrpkg/scripts/weight.qs");
-    
-    if (!in.open(QIODevice::ReadOnly))
-    {
-        log(Error, "Unable to open the resource :weight.qs");
-        return false;
-    }
-    
-    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    // weight.qs et weight.conf
+    foreach (const QString &weightFile, QStringList() << "weight.qs" << "weight.conf")
     {
-        log(Error, "Unable to open " + tmpRoot + "/etc/lgrpkg/scripts/weight.qs for writing");
-        return false;
+        QFile in(":" + weightFile);
+        QFile out(tmpRoot + "/etc/lgrpkg/scripts/" + weightFile);
+        
+        if (!in.open(QIODevice::ReadOnly))
+        {
+            log(Error, "Unable to open the resource :" + weightFile);
+            return false;
+        }
+        
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            log(Error, "Unable to open " + tmpRoot + "/etc/lgrpkg/scripts/" + weightFile + " for writing");
+            return false;
+        }
+        
+        out.write(in.readAll());
+        out.close();
     }
     
-    out.write(in.readAll());
-    out.close();
-    
     // /usr/bin/lgrpkg/scriptapi
     if (!QFile::copy("/usr/bin/lgrpkg/scriptapi", tmpRoot + "/usr/bin/lgrpkg/scriptapi"))
     {
@@ -1077,6 +1080,7 @@ bool Worker::importPackages(PackageSystem* &ps, RepositoryManager* &mg)
     }
     
     QString farch;
+    QStringList binaries;
     
     for (int i=0; i<builtPackages.count(); ++i)
     {
@@ -1095,22 +1099,30 @@ bool Worker::importPackages(PackageSystem* &ps, RepositoryManager* &mg)
                 delete ps;
                 return false;
             }
+            
+            // Plus besoin du fichier
+            QFile::remove(fname);
         }
         else
         {
-            if (!mg->includePackage(fname))
-            {
-                log(Error, "Unable to include the package " + fname);
-                psError(ps);
-                
-                QDir::setCurrent(currentDir);
-                delete mg;
-                delete ps;
-                return false;
-            }
+            binaries.append(fname);
         }
+    }
+    
+    // Les paquets binaires sont lus en parallèle
+    if (!mg->includePackages(binaries))
+    {
+        log(Error, "Unable to include the packages " + binaries.join(", "));
+        psError(ps);
         
-        // Plus besoin du fichier
+        QDir::setCurrent(currentDir);
+        delete mg;
+        delete ps;
+        return false;
+    }
+    
+    foreach (const QString &fname, binaries)
+    {
         QFile::remove(fname);
     }
     
@@ -39,7 +39,25 @@
                         <em>libinitng</em> peut appartenir au paquet numéro 22 et au paquet
                         numéro 45, c'est à dire par exemple libinitng~0.7.0 et
                         libinitng~0.7.1. Ainsi, la résolution des dépendances est largement
-                        accélérée
+                        accélérée. Seuls les noms et les provides y ont une entrée
+     - @b files       : Arbre des fichiers et dossiers installés par les paquets, une
+                        liste de _File suivie des noms
+     - @b fileindex   : Noms de fichiers triés (_FileName), permettant de rechercher
+                        rapidement un fichier par son nom sans explorer @b files
+     - @b states      : Commence par le nombre de paquets, suivi pour chaque paquet de
+                        l'index du paquet du même nom et de la même distribution ayant
+                        la version la plus récente (-1 s'il est lui-même le plus récent),
+                        puis d'un tableau de bits (entiers de 32 bits) dont le bit n
+                        est à 1 si le paquet n est installé. Permet de trouver les mises
+                        à jour et les orphelins sans explorer tous les paquets
+     - @b columns     : Copie en colonnes (voir _Columns) des champs de _Package les
+                        plus utilisés lors de l'exploration de tous les paquets
+     - @b *.mdcache   : Pour chaque fichier <em>dépôt_distribution_arch.metadata</em>,
+                        les titres, votes et icônes des paquets compilés sous forme
+                        binaire (voir _MetadataCache), lus sans analyser le XML
+     - @b generation  : Empreinte aléatoire (texte) écrite à la fin de chaque
+                        reconstruction, et supprimée au début. Voir
+                        DatabaseReader::generation()
                                     
 */
 
@@ -84,6 +102,33 @@ struct _Package
     int32_t index;      /*!< @brief Index du paquet (utilisé par databasewriter) */
 };
 
+/**
+ * @brief Version du format du fichier @b columns
+ * 
+ * Un fichier @b columns d'une autre version est ignoré par DatabaseReader.
+ */
+#define DATABASE_COLUMNS_VERSION 1
+
+/**
+ * @brief En-tête du fichier @b columns
+ * 
+ * Une _Package fait 140 octets, alors que l'exploration de tous les paquets
+ * (recherche par nom, par flags) n'utilise que quelques-uns de ses champs.
+ * Le fichier @b columns contient ces champs dans des tableaux contigus
+ * d'entiers de 32 bits, un élément par paquet, dans cet ordre :
+ * 
+ *  - @b name : copie de _Package::name
+ *  - @b version : copie de _Package::version
+ *  - @b flags : copie de _Package::flags, tenue à jour par DatabaseReader::updateState()
+ * 
+ * Les _Package restent la référence, les colonnes n'étant qu'un index.
+ */
+struct _Columns
+{
+    int32_t version;    /*!< @brief Version du format, DATABASE_COLUMNS_VERSION */
+    int32_t count;      /*!< @brief Nombre de paquets, donc d'éléments dans chaque colonne */
+};
+
 /**
  * @brief Fichier ou dossier d'un paquet
  */
@@ -99,13 +144,74 @@ struct _File
     uint32_t itime;     /*!< @brief Timestamp UNIX de la date d'installation */
 };
 
+/**
+ * @brief Nom de fichier dans l'index @b fileindex
+ * 
+ * Le fichier @b fileindex commence par un entier contenant le nombre de noms
+ * différents. Viennent ensuite les _FileName triés par nom (strcmp), puis
+ * autant d'entiers donnant l'index de chaque _FileName dans l'ordre du tri
+ * des noms lus à l'envers (pour les motifs comme <em>*.pc</em>). Enfin, la
+ * zone de données contient les index des _File portant chaque nom.
+ */
+struct _FileName
+{
+    int32_t name_ptr;   /*!< @brief Pointeur du nom dans la zone de donnée de @ files */
+    int32_t ptr;        /*!< @brief Pointeur sur le premier index de _File à partir du début des données */
+    int32_t count;      /*!< @brief Nombre de fichiers (pas de dossiers) portant ce nom */
+};
+
+/**
+ * @brief Version du format des fichiers @b *.mdcache
+ */
+#define DATABASE_METADATA_VERSION 1
+
+/**
+ * @brief En-tête d'un fichier @b *.mdcache
+ * 
+ * L'en-tête est suivi de @p count _MetadataPackage, puis de la zone de données.
+ * Cette dernière contient les chaînes (UTF-8, terminées par un zéro), les tableaux
+ * de _MetadataTitle (alignés sur 4 octets) et les icônes déjà décodées du base64,
+ * mais pas encore en tant qu'image.
+ */
+struct _MetadataCache
+{
+    int32_t version;    /*!< @brief Version du format, DATABASE_METADATA_VERSION */
+    int32_t count;      /*!< @brief Nombre de _MetadataPackage */
+};
+
+/**
+ * @brief Métadonnées d'un paquet dans un fichier @b *.mdcache
+ * 
+ * Tous les pointeurs partent du début de la zone de données.
+ */
+struct _MetadataPackage
+{
+    int32_t name_ptr;       /*!< @brief Pointeur sur le nom du paquet */
+    int32_t primarylang_ptr; /*!< @brief Pointeur sur la langue principale du paquet */
+    int32_t votes;          /*!< @brief Nombre de votes positifs */
+    int32_t total_votes;    /*!< @brief Nombre total de votes */
+    int32_t titles_ptr;     /*!< @brief Pointeur sur le premier _MetadataTitle */
+    int32_t titles_count;   /*!< @brief Nombre de _MetadataTitle (un par langue) */
+    int32_t icon_ptr;       /*!< @brief Pointeur sur les données de l'icône */
+    int32_t icon_size;      /*!< @brief Taille de l'icône, 0 si le paquet n'en a pas */
+};
+
+/**
+ * @brief Titre d'un paquet dans une langue
+ */
+struct _MetadataTitle
+{
+    int32_t lang_ptr;   /*!< @brief Pointeur sur le code de la langue (<em>fr</em>, <em>en</em>, etc) */
+    int32_t title_ptr;  /*!< @brief Pointeur sur le titre, déjà débarrassé de ses espaces superflus */
+};
+
 /**
     @brief Chaîne de caractère
 */
 struct _String
 {
     int32_t ptr;        /*!< @brief Pointeur à partir du début de la table des données */
-    int32_t strpkg;     /*!< @brief Index d'un StrPackagePtr dans strpackages */
+    int32_t strpkg;     /*!< @brief Index d'un StrPackagePtr dans strpackages, -1 si aucun paquet ne porte ce nom */
 };
 
 /**
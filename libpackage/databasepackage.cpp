@@ -204,6 +204,8 @@ void DatabasePackage::registerState(int idate, int iby, Package::Flag flags)
     d->dbpkg->idate = idate;
     d->dbpkg->iby = iby;
     d->dbpkg->flags = flags;
+    
+    d->psd->updateState(d->index);
 }
 
 bool DatabasePackage::download()
@@ -559,6 +561,8 @@ void DatabasePackage::setFlags(Flag flags)
     _Package *pkg = d->psd->package(d->index);
     
     pkg->flags = flags;
+    
+    d->psd->updateState(d->index);
 }
 
 Package::Flag DatabasePackage::flags()
@@ -26,6 +26,9 @@
 #include "databasepackage.h"
 
 #include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
 #include <QRegExp>
 #include <QDebug>
 
@@ -44,6 +47,12 @@ DatabaseReader::DatabaseReader(PackageSystem *_ps)
     f_depends = 0;
     f_strpackages = 0;
     f_files = 0;
+    f_fileindex = 0;
+    m_fileindex = 0;
+    f_states = 0;
+    m_states = 0;
+    f_columns = 0;
+    m_columns = 0;
 }
 
 bool DatabaseReader::initialized() const
@@ -61,6 +70,71 @@ bool DatabaseReader::init()
     if (!mapFile("strpackages", &f_strpackages, &m_strpackages)) return false;
     if (!mapFile("files", &f_files, &m_files)) return false;
     
+    // L'index des noms de fichiers n'existe pas dans les bases de donnée
+    // créées par d'anciennes versions, files(QRegExp) s'en passe alors
+    if (QFile::exists(ps->varRoot() + "/var/cache/lgrpkg/db/fileindex"))
+    {
+        if (!mapFile("fileindex", &f_fileindex, &m_fileindex)) return false;
+        
+        // Un index tronqué ou d'une autre base de donnée est ignoré
+        if (!validFileIndex())
+        {
+            f_fileindex->close();
+            f_fileindex->unmap(m_fileindex);
+            delete f_fileindex;
+            f_fileindex = 0;
+            m_fileindex = 0;
+        }
+    }
+    
+    // Même chose pour les états, utilisés par orphans() et upgradePackages(). Un
+    // fichier d'une reconstruction interrompue est ignoré s'il ne correspond pas
+    // à la liste des paquets
+    if (QFile::exists(ps->varRoot() + "/var/cache/lgrpkg/db/states"))
+    {
+        if (!mapFile("states", &f_states, &m_states)) return false;
+        
+        qint64 count = packages();
+        qint64 size = 4 + count * sizeof(int32_t) + ((count + 31) / 32) * sizeof(uint32_t);
+        
+        if (f_states->size() < size || *(int32_t *)m_states != count)
+        {
+            f_states->close();
+            f_states->unmap(m_states);
+            delete f_states;
+            f_states = 0;
+            m_states = 0;
+        }
+    }
+    
+    // Et pour les colonnes, qui doivent en plus avoir le bon format
+    if (QFile::exists(ps->varRoot() + "/var/cache/lgrpkg/db/columns"))
+    {
+        if (!mapFile("columns", &f_columns, &m_columns)) return false;
+        
+        _Columns *cols = (_Columns *)m_columns;
+        qint64 size = sizeof(_Columns) + 3 * (qint64)packages() * sizeof(int32_t);
+        
+        if (f_columns->size() < size || cols->version != DATABASE_COLUMNS_VERSION || cols->count != packages())
+        {
+            f_columns->close();
+            f_columns->unmap(m_columns);
+            delete f_columns;
+            f_columns = 0;
+            m_columns = 0;
+        }
+    }
+    
+    // Empreinte de la reconstruction, voir generation()
+    QFile gfl(ps->varRoot() + "/var/cache/lgrpkg/db/generation");
+    
+    m_generation.clear();
+    
+    if (gfl.open(QIODevice::ReadOnly))
+    {
+        m_generation = gfl.readAll().trimmed();
+    }
+    
     _initialized = true;
     
     return true;
@@ -116,6 +190,30 @@ void DatabaseReader::closeFiles()
         delete f_files;
         f_files = 0;
     }
+    if (f_fileindex != 0)
+    {
+        f_fileindex->close();
+        f_fileindex->unmap(m_fileindex);
+        delete f_fileindex;
+        f_fileindex = 0;
+        m_fileindex = 0;
+    }
+    if (f_states != 0)
+    {
+        f_states->close();
+        f_states->unmap(m_states);
+        delete f_states;
+        f_states = 0;
+        m_states = 0;
+    }
+    if (f_columns != 0)
+    {
+        f_columns->close();
+        f_columns->unmap(m_columns);
+        delete f_columns;
+        f_columns = 0;
+        m_columns = 0;
+    }
 }
 
 DatabaseReader::~DatabaseReader()
@@ -130,6 +228,37 @@ bool DatabaseReader::packagesByName(const QRegExp &regex, QVector<int> &rs)
     QString pkgname;
 
     int32_t count = *(int32_t *)m_packages;     // Nombre de paquets
+    
+    if (m_columns != 0)
+    {
+        // Ne tester qu'une fois chaque nom, les versions d'un paquet le partagent
+        const int32_t *names = column(NameColumn);
+        QHash<int32_t, bool> matches;
+        
+        for (int i=0; i<count; ++i)
+        {
+            int32_t name = names[i];
+            QHash<int32_t, bool>::const_iterator it = matches.constFind(name);
+            bool match;
+            
+            if (it == matches.constEnd())
+            {
+                match = regex.exactMatch(QString(string(false, name)));
+                matches.insert(name, match);
+            }
+            else
+            {
+                match = it.value();
+            }
+            
+            if (match)
+            {
+                rs.append(i);
+            }
+        }
+        
+        return true;
+    }
 
     // Explorer les paquets
     for (int i=0; i<count; ++i)
@@ -154,6 +283,33 @@ QVector<int> DatabaseReader::packagesByVString(const QString &name, const QStrin
     
     QString pname, pver;
     
+    if (m_columns != 0)
+    {
+        // Les chaînes sont uniques, il suffit de comparer des index
+        int32_t nindex = nameIndex(name.toUtf8());
+        const int32_t *names = column(NameColumn);
+        const int32_t *versions = column(VersionColumn);
+        QByteArray cmpVersion = version.toUtf8();
+        
+        if (nindex == -1)
+        {
+            return rs;
+        }
+        
+        for (int i=0; i<count; ++i)
+        {
+            if (names[i] != nindex) continue;
+            
+            if (version.isNull() || 
+                PackageSystem::matchVersion(QByteArray(string(false, versions[i])), cmpVersion, op))
+            {
+                rs.append(i);
+            }
+        }
+        
+        return rs;
+    }
+    
     for (int i=0; i<count; ++i)
     {
         _Package *pkg = package(i);
@@ -180,6 +336,49 @@ QVector<int> DatabaseReader::packagesByVString(const QString &name, const QStrin
     return rs;
 }
 
+QVector<int> DatabaseReader::packagesWithFlags(int32_t mask, int32_t value)
+{
+    QVector<int> rs;
+    int32_t count = *(int32_t *)m_packages;
+    
+    if (m_columns == 0)
+    {
+        for (int i=0; i<count; ++i)
+        {
+            if ((package(i)->flags & mask) == value)
+            {
+                rs.append(i);
+            }
+        }
+        
+        return rs;
+    }
+    
+    const int32_t *flags = column(FlagsColumn);
+    
+    // Tester les paquets par blocs de 32, sans branchement, puis n'explorer
+    // que les bits à 1 du masque obtenu
+    for (int base=0; base<count; base+=32)
+    {
+        int n = qMin(32, count - base);
+        const int32_t *f = flags + base;
+        uint32_t bits = 0;
+        
+        for (int j=0; j<n; ++j)
+        {
+            bits |= (uint32_t)((f[j] & mask) == value) << j;
+        }
+        
+        while (bits)
+        {
+            rs.append(base + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    
+    return rs;
+}
+
 QVector<int> DatabaseReader::packagesByVString(const QString &verStr)
 {
     // Parser la version
@@ -195,25 +394,46 @@ bool DatabaseReader::package(const QString &name, const QString &version, int &r
 {
     QString pkgname;
     int32_t count = *(int32_t *)m_packages;
-
-    for (int i=0; i<count; ++i)
+    
+    if (m_columns != 0)
     {
-        _Package *pkg = package(i);
+        int32_t nindex = nameIndex(name.toUtf8());
+        const int32_t *names = column(NameColumn);
+        const int32_t *versions = column(VersionColumn);
+        QByteArray cmpVersion = version.toUtf8();
         
-        pkgname = QString(string(false, pkg->name));
-
-        if (pkgname == name)
+        for (int i=0; nindex != -1 && i<count; ++i)
         {
-            // Vérifier aussi la version
-            if (version.isNull())
+            if (names[i] != nindex) continue;
+            
+            if (version.isNull() || cmpVersion == string(false, versions[i]))
             {
                 rs = i;
                 return true;
             }
-            else if (version == QString(string(false, pkg->version)))
+        }
+    }
+    else
+    {
+        for (int i=0; i<count; ++i)
+        {
+            _Package *pkg = package(i);
+            
+            pkgname = QString(string(false, pkg->name));
+
+            if (pkgname == name)
             {
-                rs = i;
-                return true;
+                // Vérifier aussi la version
+                if (version.isNull())
+                {
+                    rs = i;
+                    return true;
+                }
+                else if (version == QString(string(false, pkg->version)))
+                {
+                    rs = i;
+                    return true;
+                }
             }
         }
     }
@@ -234,20 +454,250 @@ bool DatabaseReader::package(const QString &name, const QString &version, int &r
     return false;
 }
 
+static bool isWildcardChar(char c)
+{
+    return (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\');
+}
+
+static void wildcardAffixes(const QRegExp &regex, QByteArray &prefix, QByteArray &suffix)
+{
+    // Seuls les motifs simples et sensibles à la casse ont des parties littérales
+    QRegExp::PatternSyntax syntax = regex.patternSyntax();
+    
+    if (regex.caseSensitivity() != Qt::CaseSensitive)
+    {
+        return;
+    }
+    
+    if (syntax != QRegExp::Wildcard && syntax != QRegExp::WildcardUnix && syntax != QRegExp::FixedString)
+    {
+        return;
+    }
+    
+    QByteArray pattern = regex.pattern().toUtf8();
+    int len = pattern.length();
+    int first = 0, last = len;
+    
+    if (syntax == QRegExp::FixedString)
+    {
+        prefix = pattern;
+        suffix = pattern;
+        return;
+    }
+    
+    // Partie littérale au début du motif
+    while (first < len && !isWildcardChar(pattern.at(first)))
+    {
+        first++;
+    }
+    
+    prefix = pattern.left(first);
+    
+    if (first == len)
+    {
+        // Pas de joker, le motif entier doit correspondre
+        suffix = pattern;
+        return;
+    }
+    
+    // Partie littérale à la fin du motif
+    while (last > first && !isWildcardChar(pattern.at(last - 1)))
+    {
+        last--;
+    }
+    
+    suffix = pattern.mid(last);
+}
+
+static int compareSuffix(const char *name, const QByteArray &suffix)
+{
+    // Compare les deux chaînes lues à l'envers, sur la longueur de suffix.
+    // C'est l'ordre dans lequel DatabaseWriter trie les noms inversés
+    int nlen = strlen(name);
+    int slen = suffix.length();
+    
+    for (int i=0; i<slen; ++i)
+    {
+        if (i == nlen)
+        {
+            return -1;
+        }
+        
+        uchar a = name[nlen - 1 - i];
+        uchar b = suffix.at(slen - 1 - i);
+        
+        if (a != b)
+        {
+            return (a < b ? -1 : 1);
+        }
+    }
+    
+    return 0;
+}
+
+void DatabaseReader::appendFile(QVector<PackageFile *> &rs, int index)
+{
+    _File *fl = file(index);
+    
+    if (fl == 0)
+    {
+        return;
+    }
+    
+    rs.append((PackageFile *)(new DatabaseFile(ps, this, fl, new DatabasePackage(fl->package, ps, this), true)));
+}
+
+bool DatabaseReader::validFileIndex()
+{
+    // Structure de fileindex, voir databaseformat.h
+    qint64 size = f_fileindex->size();
+    qint64 nfiles = *(int32_t *)m_files;
+    qint64 strsize = f_files->size() - 8 - nfiles * (qint64)sizeof(_File);
+    
+    if (size < 4)
+    {
+        return false;
+    }
+    
+    // Il ne peut pas y avoir plus de noms que de fichiers
+    qint64 count = *(int32_t *)m_fileindex;
+    qint64 header = 4 + count * (qint64)(sizeof(_FileName) + sizeof(int32_t));
+    
+    if (count < 0 || count > nfiles || size < header)
+    {
+        return false;
+    }
+    
+    const _FileName *names = (const _FileName *)(m_fileindex + 4);
+    const int32_t *reversed = (const int32_t *)(names + count);
+    qint64 datasize = size - header;
+    
+    for (qint64 i=0; i<count; ++i)
+    {
+        const _FileName &fn = names[i];
+        
+        if (fn.name_ptr < 0 || fn.name_ptr >= strsize ||
+            fn.ptr < 0 || fn.count < 0 ||
+            fn.ptr + (qint64)fn.count * (qint64)sizeof(int32_t) > datasize ||
+            reversed[i] < 0 || reversed[i] >= count)
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
 QVector<PackageFile *> DatabaseReader::files(const QRegExp &regex)
 {
     QVector<PackageFile *> rs;
     
-    int count = *(int32_t *)m_files;
+    if (m_fileindex == 0)
+    {
+        // Pas d'index, explorer tous les fichiers
+        int count = *(int32_t *)m_files;
+        
+        for (int i=0; i<count; ++i)
+        {
+            _File *fl = file(i);
+            
+            if ((fl->flags & PackageFile::Directory) == 0 &&
+                regex.exactMatch(QString::fromUtf8(fileString(fl->name_ptr))))
+            {
+                appendFile(rs, i);
+            }
+        }
+        
+        return rs;
+    }
     
-    // Explorer tous les fichiers
-    for (int i=0; i<count; ++i)
+    // Structure de fileindex, voir databaseformat.h
+    int32_t count = *(int32_t *)m_fileindex;
+    _FileName *names = (_FileName *)(m_fileindex + 4);
+    int32_t *reversed = (int32_t *)(names + count);
+    uchar *data = (uchar *)(reversed + count);
+    
+    QByteArray prefix, suffix;
+    int first = 0, last = count, lo, hi, mid;
+    bool useReversed = false;
+    
+    wildcardAffixes(regex, prefix, suffix);
+    
+    // Restreindre les noms à tester grâce au plus long des deux
+    if (!prefix.isEmpty() && prefix.length() >= suffix.length())
     {
-        _File *fl = file(i);
+        const char *p = prefix.constData();
+        int plen = prefix.length();
         
-        if (regex.exactMatch(fileString(fl->name_ptr)))
+        lo = 0;
+        hi = count;
+        
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            
+            if (strncmp(fileString(names[mid].name_ptr), p, plen) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        
+        first = lo;
+        hi = count;
+        
+        while (lo < hi)
         {
-            rs.append((PackageFile *)(new DatabaseFile(ps, this, fl, new DatabasePackage(fl->package, ps, this), true)));
+            mid = (lo + hi) / 2;
+            
+            if (strncmp(fileString(names[mid].name_ptr), p, plen) <= 0) lo = mid + 1;
+            else hi = mid;
+        }
+        
+        last = lo;
+    }
+    else if (!suffix.isEmpty())
+    {
+        useReversed = true;
+        lo = 0;
+        hi = count;
+        
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            
+            if (compareSuffix(fileString(names[reversed[mid]].name_ptr), suffix) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        
+        first = lo;
+        hi = count;
+        
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            
+            if (compareSuffix(fileString(names[reversed[mid]].name_ptr), suffix) <= 0) lo = mid + 1;
+            else hi = mid;
+        }
+        
+        last = lo;
+    }
+    
+    for (int i=first; i<last; ++i)
+    {
+        _FileName *fn = names + (useReversed ? reversed[i] : i);
+        const char *name = fileString(fn->name_ptr);
+        
+        // Vérifier l'autre extrémité du motif avant de construire une QString
+        if (!prefix.isEmpty() && strncmp(name, prefix.constData(), prefix.length()) != 0) continue;
+        if (!suffix.isEmpty() && compareSuffix(name, suffix) != 0) continue;
+        
+        if (!regex.exactMatch(QString::fromUtf8(name))) continue;
+        
+        // Tous les fichiers portant ce nom correspondent
+        int32_t *fls = (int32_t *)(data + fn->ptr);
+        
+        for (int j=0; j<fn->count; ++j)
+        {
+            appendFile(rs, fls[j]);
         }
     }
     
@@ -355,8 +805,15 @@ QVector<int> DatabaseReader::packagesOfString(int stringIndex, int nameIndex, De
     // Index
     str += (nameIndex * sizeof(_String));
 
-    // Trouver le StringPackagePtr
+    // Trouver le StringPackagePtr. Les chaînes qui ne sont le nom d'aucun paquet
+    // n'en ont pas
     int32_t spptr = ((_String *)(str))->strpkg;
+    
+    if (spptr < 0)
+    {
+        return rs;
+    }
+    
     uchar *strpkg = m_strpackages;
     int32_t numptrs = *(int32_t *)strpkg;
 
@@ -392,11 +849,107 @@ QVector<int> DatabaseReader::packagesOfString(int stringIndex, int nameIndex, De
     return rs;
 }
 
+uint32_t *DatabaseReader::installedBitmap()
+{
+    // Voir databaseformat.h : nombre de paquets, newest[], puis le tableau de bits
+    int32_t npkgs = *(int32_t *)m_states;
+    
+    return (uint32_t *)(m_states + 4 + npkgs * sizeof(int32_t));
+}
+
+int32_t *DatabaseReader::column(Column col)
+{
+    // Voir _Columns : l'en-tête, puis les colonnes les unes après les autres
+    _Columns *cols = (_Columns *)m_columns;
+    
+    return (int32_t *)(m_columns + sizeof(_Columns)) + (int)col * cols->count;
+}
+
+int32_t DatabaseReader::nameIndex(const QByteArray &name)
+{
+    // Index de la chaîne d'un nom de paquet, -1 si aucun paquet ne porte ce nom
+    const int32_t *names = column(NameColumn);
+    int32_t count = *(int32_t *)m_packages;
+    int32_t last = -1;
+    
+    for (int i=0; i<count; ++i)
+    {
+        if (names[i] == last) continue;
+        
+        last = names[i];
+        
+        if (strcmp(string(false, last), name.constData()) == 0)
+        {
+            return last;
+        }
+    }
+    
+    return -1;
+}
+
+void DatabaseReader::updateState(int index)
+{
+    _Package *pkg = package(index);
+    
+    if (pkg == 0)
+    {
+        return;
+    }
+    
+    if (m_columns != 0)
+    {
+        column(FlagsColumn)[index] = pkg->flags;
+    }
+    
+    if (m_states == 0 || index >= *(int32_t *)m_states)
+    {
+        return;
+    }
+    
+    uint32_t *bitmap = installedBitmap();
+    
+    if (pkg->flags & Package::Installed)
+    {
+        bitmap[index / 32] |= (1U << (index % 32));
+    }
+    else
+    {
+        bitmap[index / 32] &= ~(1U << (index % 32));
+    }
+}
+
 QVector<int> DatabaseReader::orphans()
 {
     int32_t npkgs = *(int *)m_packages;
     QVector<int> rs;
     
+    if (m_states != 0)
+    {
+        // N'explorer que les paquets installés
+        uint32_t *bitmap = installedBitmap();
+        int words = (npkgs + 31) / 32;
+        
+        for (int w=0; w<words; ++w)
+        {
+            uint32_t bits = bitmap[w];
+            
+            while (bits)
+            {
+                int i = w * 32 + __builtin_ctz(bits);
+                _Package *pkg = package(i);
+                
+                bits &= bits - 1;
+                
+                if ((pkg->flags & Package::Wanted) == 0 && pkg->used == 0)
+                {
+                    rs.append(i);
+                }
+            }
+        }
+        
+        return rs;
+    }
+    
     for (int i=0; i<npkgs; ++i)
     {
         _Package *pkg = package(i);
@@ -418,6 +971,37 @@ QList<UpgradeInfo> DatabaseReader::upgradePackages()
     QList<UpgradeInfo> rs;
     UpgradeInfo ui;
     
+    if (m_states != 0)
+    {
+        // La version la plus récente de chaque paquet est connue
+        int32_t *newest = (int32_t *)(m_states + 4);
+        uint32_t *bitmap = installedBitmap();
+        int words = (npkgs + 31) / 32;
+        
+        for (int w=0; w<words; ++w)
+        {
+            uint32_t bits = bitmap[w];
+            
+            while (bits)
+            {
+                int i = w * 32 + __builtin_ctz(bits);
+                _Package *pkg = package(i);
+                
+                bits &= bits - 1;
+                
+                if (newest[i] != -1 && !(pkg->flags & Package::DontUpdate))
+                {
+                    ui.installedPackage = i;
+                    ui.newPackage = newest[i];
+                    
+                    rs.append(ui);
+                }
+            }
+        }
+        
+        return rs;
+    }
+    
     // Explorer chaque paquet
     for (int i=0; i<npkgs; ++i)
     {
@@ -459,6 +1043,46 @@ int DatabaseReader::packages()
     return *(int *)m_packages;
 }
 
+QByteArray DatabaseReader::generation()
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    int count = packages();
+    
+    if (!m_generation.isEmpty())
+    {
+        // Empreinte aléatoire écrite par chaque reconstruction
+        hash.addData(m_generation);
+    }
+    else
+    {
+        // Base de donnée d'une ancienne version, ou reconstruction interrompue : le
+        // fichier packages est au moins réécrit à chaque mise à jour
+        QFileInfo fi(f_packages->fileName());
+        
+        hash.addData(QByteArray::number(fi.lastModified().toTime_t()) + ' ' + QByteArray::number(fi.size()));
+    }
+    
+    // Drapeaux des paquets : Installed, mais aussi DontInstall, DontRemove, DontUpdate
+    // et Wanted, que setFlags() et registerState() changent sans réécrire le fichier
+    if (m_columns != 0)
+    {
+        hash.addData((const char *)column(FlagsColumn), count * sizeof(int32_t));
+    }
+    else
+    {
+        QVector<int32_t> flags(count);
+        
+        for (int i=0; i<count; ++i)
+        {
+            flags[i] = package(i)->flags;
+        }
+        
+        hash.addData((const char *)flags.constData(), count * sizeof(int32_t));
+    }
+    
+    return hash.result().toHex();
+}
+
 _Depend *DatabaseReader::depend(int32_t ptr)
 {
     int numdepsptr = *(int *)m_depends;
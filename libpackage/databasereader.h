@@ -203,6 +203,9 @@ class DatabaseReader
             Place dans @p rs une liste d'entiers dont chaque élément est l'index
             d'un paquet dont le nom correspond à l'expression régulière @p regex.
             
+            Grâce au fichier @b columns, chaque nom n'est testé qu'une fois, quel
+            que soit le nombre de versions du paquet.
+            
             @warning Cette fonction a une complexité de O(n) où n est le nombre
                      de paquets dans la distribution.
                      
@@ -242,6 +245,26 @@ class DatabaseReader
         */
         QVector<int> packagesByVString(const QString &name, const QString &version, Depend::Operation op);
         
+        /**
+            @brief Liste des paquets dont les flags correspondent à un masque
+            
+            Renvoie les paquets pour lesquels <em>(flags & @p mask) == @p value</em>.
+            Par exemple, packagesWithFlags(Package::Installed, 0) renvoie les paquets
+            non-installés.
+            
+            La colonne des flags du fichier @b columns est explorée par blocs de 32
+            paquets sans branchement, ce que le compilateur peut vectoriser.
+            
+            @warning Cette fonction a une complexité de O(n) où n est le nombre
+                     de paquets dans la distribution, mais ne lit que 4 octets
+                     par paquet.
+            
+            @param mask Flags à vérifier
+            @param value Valeur que doivent avoir les flags de @p mask
+            @return Liste des paquets qui correspondent
+        */
+        QVector<int> packagesWithFlags(int32_t mask, int32_t value);
+        
         /**
             @brief Retourne les fichier correspondant au nom name
             
@@ -260,13 +283,21 @@ class DatabaseReader
             @brief Retourne les fichiers correspondant à l'expression régulière
             
             Retourne la liste des fichiers dont le nom (le chemin d'accès n'est
-            pas considéré) correspond à l'expression régulière regex.
-            
-            @warning Cette fonction a une complexité de O(n) où n est le nombre
-                     de fichiers dans la base de donnée. Elle peut être très
-                     lente si la regex est complexe, ou s'il y a beaucoup de
-                     fichiers (forte utilisation de QString::QString(), ainsi
-                     que stress du système de fichiers).
+            pas considéré) correspond à l'expression régulière regex. Les
+            dossiers ne sont pas renvoyés.
+            
+            L'index @b fileindex (voir _FileName) est utilisé : chaque nom n'est
+            testé qu'une fois, quel que soit le nombre de fichiers le portant.
+            Si @p regex est un motif (QRegExp::Wildcard, QRegExp::WildcardUnix
+            ou QRegExp::FixedString) sensible à la casse, son préfixe ou son
+            suffixe littéral (<em>msg*</em>, <em>*.pc</em>) permet de ne tester
+            que les noms qui commencent ou finissent par lui, trouvés par
+            recherche dichotomique.
+            
+            @note Cette fonction a une complexité de O(log n + m) où n est le
+                  nombre de noms de fichiers différents et m le nombre de noms
+                  ayant le bon préfixe ou suffixe. Sans préfixe ni suffixe,
+                  ou avec une expression régulière, m vaut n.
                      
             @param regex Expression régulière
             @return Liste des fichiers dont le nom correspond au motif
@@ -335,11 +366,14 @@ class DatabaseReader
         QVector<int> packagesOfString(int stringIndex, int nameIndex, Depend::Operation op);
         
         /**
-            @brief Liste des paquets dont la version installée est différente de la version du dépôt
-            @note C'est normalement une version plus récente dans les dépôts, sauf s'ils sont cassés.
-                  Ne pas vérifier cela permet d'éviter un appel à compareVersions, lourd et lent.
-            @warning Cette fonction a une complexité de O(n) où n est le nombre
-                     de paquets dans le dépôt.
+            @brief Liste des paquets installés pour lesquels une version plus récente existe
+            
+            Pour chaque paquet installé, la version la plus récente du même nom et de la
+            même distribution est lue dans le fichier @b states, calculé par DatabaseWriter.
+            
+            @note Cette fonction a une complexité de O(n/32 + m) où n est le nombre de
+                  paquets dans le dépôt et m le nombre de paquets installés. Sans fichier
+                  @b states (ancienne base de donnée), elle est de O(n).
             @return Paquets qu'on peut mettre à jour
         */
         QList<UpgradeInfo> upgradePackages();
@@ -350,13 +384,39 @@ class DatabaseReader
             Renvoie la liste des paquets qui ont été installés automatiquement en tant que dépendances,
             mais qui ne sont plus nécessaires à aucun paquet demandé par l'utilisateur
             
-            @warning Cette fonction a une complexité de O(n) où n est le nombre
-                     de paquets dans le dépôt
+            @note Cette fonction n'explore que les paquets installés, grâce au fichier @b states.
+                  Elle a la même complexité que upgradePackages().
             @return Paquets orphelins
         */
         QVector<int> orphans();
         
+        /**
+            @brief Met à jour l'index des paquets installés
+            
+            Doit être appelée après toute modification des flags d'un paquet dans le
+            fichier mappé, pour que orphans() et upgradePackages() restent justes.
+            
+            @param index Index du paquet modifié
+        */
+        void updateState(int index);
+        
         int packages(); /*!< @brief Nombre de paquets disponibles dans la base de donnée */
+        
+        /**
+            @brief Génération de la base de donnée
+            
+            Empreinte qui change quand la base de donnée est reconstruite
+            (fichier @b generation, écrit par DatabaseWriter::rebuild())
+            ou quand les drapeaux d'un paquet changent (installation,
+            suppression, DontInstall, DontRemove, DontUpdate, Wanted).
+            Permet de savoir si un résultat calculé précédemment est
+            toujours valable.
+            
+            @note Cette fonction a une complexité O(n), où n est le nombre
+                  de paquets, mais lit les drapeaux d'un bloc si le fichier
+                  @b columns existe.
+        */
+        QByteArray generation();
 
         /**
             @brief Chaîne ayant un certain index
@@ -445,12 +505,27 @@ class DatabaseReader
     private:
         bool mapFile(const QString &file, QFile **ptr, uchar **map);
         void closeFiles();
+        void appendFile(QVector<PackageFile *> &rs, int index);
+        bool validFileIndex();
+        uint32_t *installedBitmap();
+        
+        enum Column
+        {
+            NameColumn = 0,
+            VersionColumn = 1,
+            FlagsColumn = 2
+        };
+        
+        int32_t *column(Column col);
+        int32_t nameIndex(const QByteArray &name);
 
     private:
         bool _initialized;
         
-        QFile *f_packages, *f_strings, *f_translate, *f_depends, *f_strpackages, *f_files;
-        uchar *m_packages, *m_strings, *m_translate, *m_depends, *m_strpackages, *m_files;
+        QFile *f_packages, *f_strings, *f_translate, *f_depends, *f_strpackages, *f_files, *f_fileindex, *f_states, *f_columns;
+        uchar *m_packages, *m_strings, *m_translate, *m_depends, *m_strpackages, *m_files, *m_fileindex, *m_states, *m_columns;
+        
+        QByteArray m_generation;    // Contenu du fichier generation, vide s'il n'existe pas
 
         PackageSystem *ps;
 };
@@ -33,7 +33,17 @@
 #include <QTime>
 
 #include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QHash>
+#include <QPair>
 #include <QProcess>
+#include <QRegExp>
+#include <QVector>
+#include <QXmlStreamReader>
+#include <QCryptographicHash>
+#include <QtAlgorithms>
 #include <QtDebug>
 
 #ifdef GPGME_FOUND
@@ -43,9 +53,18 @@
 #include <iostream>
 #include <fstream>
 
+#include <string.h>
+#include <unistd.h>
+
 using namespace std;
 using namespace Logram;
 
+// Taille d'un bloc de l'arène des chaînes
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+// Taille du tampon d'écriture des fichiers de la base de donnée
+#define WRITE_BUFFER_SIZE (1024 * 1024)
+
 struct FileFile
 {
     int index;          // index dans knownFiles
@@ -62,9 +81,427 @@ struct FileFile
     FileFile *first_child;  // Premier enfant
 };
 
+struct NameLessThan
+{
+    NameLessThan(const QList<QByteArray> *_names) : names(_names) {}
+    
+    bool operator()(int a, int b) const
+    {
+        return names->at(a) < names->at(b);
+    }
+    
+    const QList<QByteArray> *names;
+};
+
+// Clefs reconnues dans les listes de paquets
+enum ListKey
+{
+    UnknownKey,
+    ArchKey,
+    NameKey,
+    UsedKey,
+    FlagsKey,
+    SourceKey,
+    DependsKey,
+    LicenseKey,
+    SectionKey,
+    SuggestKey,
+    VersionKey,
+    ProvidesKey,
+    ReplacesKey,
+    ConflictsKey,
+    ShortDescKey,
+    MaintainerKey,
+    InstallSizeKey,
+    InstalledByKey,
+    PackageHashKey,
+    UpstreamUrlKey,
+    DistributionKey,
+    DownloadSizeKey,
+    MetadataHashKey,
+    InstalledDateKey,
+    InstalledRepoKey
+};
+
+// Identifie une clef de packages.list sans construire de QByteArray. Les clefs
+// sont d'abord triées par longueur puis par première lettre, il ne reste alors
+// qu'au plus deux candidates à comparer
+static ListKey listKey(const char *key, int length)
+{
+#define LIST_KEY(k) if (memcmp(key, #k, length) == 0) return k##Key
+    
+    switch (length)
+    {
+        case 4:
+            switch (key[0])
+            {
+                case 'A':
+                    LIST_KEY(Arch);
+                    break;
+                case 'N':
+                    LIST_KEY(Name);
+                    break;
+                case 'U':
+                    LIST_KEY(Used);
+                    break;
+            }
+            break;
+        case 5:
+            switch (key[0])
+            {
+                case 'F':
+                    LIST_KEY(Flags);
+                    break;
+            }
+            break;
+        case 6:
+            switch (key[0])
+            {
+                case 'S':
+                    LIST_KEY(Source);
+                    break;
+            }
+            break;
+        case 7:
+            switch (key[0])
+            {
+                case 'D':
+                    LIST_KEY(Depends);
+                    break;
+                case 'L':
+                    LIST_KEY(License);
+                    break;
+                case 'S':
+                    LIST_KEY(Section);
+                    LIST_KEY(Suggest);
+                    break;
+                case 'V':
+                    LIST_KEY(Version);
+                    break;
+            }
+            break;
+        case 8:
+            switch (key[0])
+            {
+                case 'P':
+                    LIST_KEY(Provides);
+                    break;
+                case 'R':
+                    LIST_KEY(Replaces);
+                    break;
+            }
+            break;
+        case 9:
+            switch (key[0])
+            {
+                case 'C':
+                    LIST_KEY(Conflicts);
+                    break;
+                case 'S':
+                    LIST_KEY(ShortDesc);
+                    break;
+            }
+            break;
+        case 10:
+            switch (key[0])
+            {
+                case 'M':
+                    LIST_KEY(Maintainer);
+                    break;
+            }
+            break;
+        case 11:
+            switch (key[0])
+            {
+                case 'I':
+                    LIST_KEY(InstallSize);
+                    LIST_KEY(InstalledBy);
+                    break;
+                case 'P':
+                    LIST_KEY(PackageHash);
+                    break;
+                case 'U':
+                    LIST_KEY(UpstreamUrl);
+                    break;
+            }
+            break;
+        case 12:
+            switch (key[0])
+            {
+                case 'D':
+                    LIST_KEY(Distribution);
+                    LIST_KEY(DownloadSize);
+                    break;
+                case 'M':
+                    LIST_KEY(MetadataHash);
+                    break;
+            }
+            break;
+        case 13:
+            switch (key[0])
+            {
+                case 'I':
+                    LIST_KEY(InstalledDate);
+                    LIST_KEY(InstalledRepo);
+                    break;
+            }
+            break;
+    }
+    
+#undef LIST_KEY
+    
+    return UnknownKey;
+}
+
+// Écrit un fichier de la base de donnée par blocs de WRITE_BUFFER_SIZE octets
+class BufferedWriter
+{
+    public:
+        BufferedWriter(QFile *_file) : file(_file), used(0)
+        {
+            buffer = new char[WRITE_BUFFER_SIZE];
+        }
+        
+        ~BufferedWriter()
+        {
+            delete[] buffer;
+        }
+        
+        void write(const char *data, qint64 length)
+        {
+            if (used + length > WRITE_BUFFER_SIZE)
+            {
+                flush();
+                
+                if (length >= WRITE_BUFFER_SIZE)
+                {
+                    // Gros tableau, l'écrire directement
+                    file->write(data, length);
+                    return;
+                }
+            }
+            
+            memcpy(buffer + used, data, length);
+            used += length;
+        }
+        
+        void writeString(const QByteArray &str)
+        {
+            char zero = 0;
+            
+            write(str.constData(), str.length());
+            write(&zero, 1);
+        }
+        
+        void flush()
+        {
+            if (used != 0)
+            {
+                file->write(buffer, used);
+                used = 0;
+            }
+        }
+        
+    private:
+        QFile *file;
+        char *buffer;
+        qint64 used;
+};
+
+static int compareStringVersions(const QList<QByteArray> &strings, int a, int b)
+{
+    // Les chaînes pointent dans l'arène de DatabaseWriter, sans zéro final
+    const QByteArray &sa = strings.at(a);
+    const QByteArray &sb = strings.at(b);
+    
+    return PackageSystem::compareVersions(QByteArray(sa.constData(), sa.size()), QByteArray(sb.constData(), sb.size()));
+}
+
+struct MetadataData
+{
+    QByteArray data;
+    QHash<QString, int32_t> strings;
+    
+    int32_t string(const QString &str)
+    {
+        int32_t ptr = strings.value(str, -1);
+        
+        if (ptr == -1)
+        {
+            ptr = data.size();
+            data += str.toUtf8();
+            data += '\0';
+            
+            strings.insert(str, ptr);
+        }
+        
+        return ptr;
+    }
+    
+    void align()
+    {
+        while (data.size() % sizeof(int32_t) != 0)
+        {
+            data += '\0';
+        }
+    }
+};
+
+static bool compileMetadata(const QString &source, const QString &dest)
+{
+    // Lire le XML des métadonnées d'un seul tenant, sans construire de QDomDocument
+    QFile in(source);
+    
+    if (!in.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    
+    QXmlStreamReader xml(&in);
+    QVector<_MetadataPackage> packages;
+    MetadataData data;
+    QVector<_MetadataTitle> titles;
+    bool inTitle = false;
+    
+    while (!xml.atEnd())
+    {
+        xml.readNext();
+        
+        if (xml.isEndElement() && xml.name() == "title")
+        {
+            inTitle = false;
+        }
+        else if (xml.isEndElement() && xml.name() == "package")
+        {
+            // Copier les titres dans la zone de données
+            _MetadataPackage &pkg = packages.last();
+            
+            data.align();
+            pkg.titles_ptr = data.data.size();
+            pkg.titles_count = titles.count();
+            data.data.append((const char *)titles.constData(), titles.count() * sizeof(_MetadataTitle));
+            
+            titles.clear();
+        }
+        else if (!xml.isStartElement() || (packages.isEmpty() && xml.name() != "package"))
+        {
+            continue;
+        }
+        else if (xml.name() == "package")
+        {
+            QXmlStreamAttributes attrs = xml.attributes();
+            _MetadataPackage pkg;
+            
+            pkg.name_ptr = data.string(attrs.value("name").toString());
+            pkg.primarylang_ptr = data.string(attrs.value("primarylang").toString());
+            pkg.votes = attrs.value("votes").toString().toInt();
+            pkg.total_votes = attrs.value("totalvotes").toString().toInt();
+            pkg.titles_ptr = 0;
+            pkg.titles_count = 0;
+            pkg.icon_ptr = 0;
+            pkg.icon_size = 0;
+            
+            packages.append(pkg);
+        }
+        else if (xml.name() == "title")
+        {
+            inTitle = true;
+        }
+        else if (inTitle)
+        {
+            // <fr>, <en>, etc. Même nettoyage que PackageMetaData::stringOfKey()
+            _MetadataTitle title;
+            
+            title.lang_ptr = data.string(xml.name().toString());
+            title.title_ptr = data.string(xml.readElementText().trimmed().replace(QRegExp("\\n[ \\t]+"), "\n"));
+            
+            titles.append(title);
+        }
+        else if (xml.name() == "icon")
+        {
+            // Seul le base64 est décodé, l'image ne l'est qu'à l'affichage
+            QByteArray icon = QByteArray::fromBase64(xml.readElementText().toAscii());
+            _MetadataPackage &pkg = packages.last();
+            
+            pkg.icon_ptr = data.data.size();
+            pkg.icon_size = icon.size();
+            data.data += icon;
+        }
+    }
+    
+    if (xml.hasError())
+    {
+        return false;
+    }
+    
+    // Écrire le fichier en une seule fois
+    _MetadataCache header;
+    QByteArray out;
+    
+    header.version = DATABASE_METADATA_VERSION;
+    header.count = packages.count();
+    
+    out.reserve(sizeof(_MetadataCache) + packages.count() * sizeof(_MetadataPackage) + data.data.size());
+    out.append((const char *)&header, sizeof(_MetadataCache));
+    out.append((const char *)packages.constData(), packages.count() * sizeof(_MetadataPackage));
+    out.append(data.data);
+    
+    // Fichier temporaire puis renommage : l'ancien fichier peut être mappé par un
+    // gestionnaire d'applications, il ne doit pas être tronqué sous ses pieds
+    QString tmpname = dest + ".new";
+    QFile fl(tmpname);
+    
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return false;
+    }
+    
+    if (fl.write(out) != out.size())
+    {
+        fl.close();
+        QFile::remove(tmpname);
+        
+        return false;
+    }
+    
+    fl.close();
+    
+    QFile::remove(dest);
+    
+    return QFile::rename(tmpname, dest);
+}
+
+static bool metadataCacheUpToDate(const QString &source, const QString &dest)
+{
+    QFileInfo sfi(source), dfi(dest);
+    
+    if (!dfi.exists() || dfi.lastModified() <= sfi.lastModified())
+    {
+        return false;
+    }
+    
+    // Format du cache changé depuis sa création
+    QFile fl(dest);
+    _MetadataCache header;
+    
+    if (!fl.open(QIODevice::ReadOnly) || fl.read((char *)&header, sizeof(_MetadataCache)) != sizeof(_MetadataCache))
+    {
+        return false;
+    }
+    
+    return (header.version == DATABASE_METADATA_VERSION);
+}
+
 DatabaseWriter::DatabaseWriter(PackageSystem *_parent)
 {
     parent = _parent;
+    arenaPos = 0;
+    arenaFree = 0;
+}
+
+DatabaseWriter::~DatabaseWriter()
+{
+    freeArena();
 }
 
 bool DatabaseWriter::download(const QString &source, const QString &url, Repository::Type type, FileDataType datatype, bool gpgCheck)
@@ -193,6 +630,66 @@ bool DatabaseWriter::verifySign(const QString &signFileName, const QByteArray &s
 }
 #endif /* GPGME_FOUND */
 
+QByteArray DatabaseWriter::intern(const QByteArray &str)
+{
+    int len = str.length();
+    
+    if (len > arenaFree)
+    {
+        // Nouveau bloc. Les chaînes plus longues qu'un bloc ont le leur
+        int size = qMax(len, ARENA_BLOCK_SIZE);
+        
+        arenaPos = new char[size];
+        arenaFree = size;
+        arenaBlocks.append(arenaPos);
+    }
+    
+    char *rs = arenaPos;
+    
+    memcpy(rs, str.constData(), len);
+    arenaPos += len;
+    arenaFree -= len;
+    
+    return QByteArray::fromRawData(rs, len);
+}
+
+void DatabaseWriter::freeArena()
+{
+    foreach(char *block, arenaBlocks)
+    {
+        delete[] block;
+    }
+    
+    arenaBlocks.clear();
+    arenaPos = 0;
+    arenaFree = 0;
+    
+    // Tout ce qui pointait dans l'arène
+    stringsIndexes.clear();
+    translateIndexes.clear();
+    fileStringsPtrs.clear();
+    stringsStrings.clear();
+    translateStrings.clear();
+    fileStrings.clear();
+    knownPackages.clear();
+}
+
+void DatabaseWriter::addKnownEntry(const QByteArray &name, knownEntry *entry)
+{
+    knownEntries.append(entry);
+    entry->version = intern(entry->version);
+    
+    QHash<QByteArray, QVector<knownEntry *> >::iterator it = knownPackages.find(name);
+    
+    if (it == knownPackages.end())
+    {
+        // La clef doit survivre au buffer de la liste
+        it = knownPackages.insert(intern(name), QVector<knownEntry *>());
+    }
+    
+    it.value().append(entry);
+}
+
 int DatabaseWriter::fileStringIndex(const QByteArray &str)
 {
     int rs = fileStringsPtrs.value(str, -1);
@@ -203,9 +700,11 @@ int DatabaseWriter::fileStringIndex(const QByteArray &str)
     }
     
     // Pas trouvé, ajouter
+    QByteArray s = intern(str);
+    
     rs = fileStrPtr;
-    fileStringsPtrs.insert(str, rs);
-    fileStrings.append(str);
+    fileStringsPtrs.insert(s, rs);
+    fileStrings.append(s);
     
     fileStrPtr += str.length() + 1;
     
@@ -214,71 +713,57 @@ int DatabaseWriter::fileStringIndex(const QByteArray &str)
 
 int DatabaseWriter::stringIndex(const QByteArray &str, int pkg, bool isTr, bool create)
 {
-    int rs;
-    bool found = false;
-    _String *mstr;
-    
-    if (isTr)
-    {
-        if (translateIndexes.contains(str))
-        {
-            rs = translateIndexes.value(str);
-            found = true;
-            mstr = translate.at(rs);
-        }
-    }
-    else
-    {
-        if (stringsIndexes.contains(str))
-        {
-            rs = stringsIndexes.value(str);
-            found = true;
-            mstr = strings.at(rs);
-        }
-    }
+    int rs = (isTr ? translateIndexes.value(str, -1) : stringsIndexes.value(str, -1));
 
-    if (!found)
+    if (rs == -1)
     {
-        // Créer une nouvelle chaîne
-        mstr = new _String;
+        // Créer une nouvelle chaîne, copiée dans l'arène. Elle n'aura d'entrée
+        // dans strpackages que si un paquet porte son nom (voir plus bas)
+        QByteArray s = intern(str);
+        _String mstr;
+        
+        mstr.strpkg = -1;
 
         // Insérer la chaîne
         if (isTr)
         {
-            mstr->ptr = transPtr;
-            mstr->strpkg = strPackages.count();
-            transPtr += str.length() + 1;
+            mstr.ptr = transPtr;
+            transPtr += s.length() + 1;
 
             translate.append(mstr);
-            translateStrings.append(str);
+            translateStrings.append(s);
             rs = translate.count()-1;
-            translateIndexes.insert(str, rs);
+            translateIndexes.insert(s, rs);
         }
         else
         {
-            mstr->ptr = strPtr;
-            mstr->strpkg = strPackages.count();
-            strPtr += str.length() + 1;
+            mstr.ptr = strPtr;
+            strPtr += s.length() + 1;
 
             strings.append(mstr);
-            stringsStrings.append(str);
+            stringsStrings.append(s);
             rs = strings.count()-1;
-            stringsIndexes.insert(str, rs);
+            stringsIndexes.insert(s, rs);
         }
-
-        strPackages.append(QVector<_StrPackage *>());
     }
 
-    // Gérer les StrPackages
-    if (create)
+    // Gérer les StrPackages. Seules les chaînes de strings (noms et provides) sont
+    // cherchées par DatabaseReader::packagesOfString(), pas les traductions
+    if (create && !isTr)
     {
-        _StrPackage *sp = new _StrPackage;
-        _Package *p = packages.at(pkg);
+        _StrPackage sp;
+        _String &mstr = strings[rs];
 
-        sp->version = p->version;
-        sp->package = pkg;
+        if (mstr.strpkg == -1)
+        {
+            mstr.strpkg = strPackages.count();
+            strPackages.append(QVector<_StrPackage>());
+        }
 
-        strPackages[mstr->strpkg].append(sp);
+        sp.version = packages.at(pkg)->version;
+        sp.package = pkg;
+
+        strPackages[mstr.strpkg].append(sp);
     }
 
     return rs;
@@ -294,7 +779,7 @@ void DatabaseWriter::setDepends(_Package *pkg, const QByteArray &str, int type)
     // Parser la chaîne
     QList<QByteArray> deps = str.split(';');
     QByteArray dep;
-    _Depend *depend;
+    _Depend depend;
     
     foreach (const QByteArray &_dep, deps)
     {
@@ -306,11 +791,10 @@ void DatabaseWriter::setDepends(_Package *pkg, const QByteArray &str, int type)
         if (op == Depend::NoVersion)
         {
             // Dépendance non-versionnée
-            depend = new _Depend;
-            depend->type = type;
-            depend->op = Depend::NoVersion;
-            depend->pkgname = stringIndex(dep, 0, false, false);
-            depend->pkgver = 0;
+            depend.type = type;
+            depend.op = Depend::NoVersion;
+            depend.pkgname = stringIndex(dep, 0, false, false);
+            depend.pkgver = 0;
 
             // Ajouter la dépendance
             depends[pkg->deps].append(depend);
@@ -331,11 +815,10 @@ void DatabaseWriter::setDepends(_Package *pkg, const QByteArray &str, int type)
         else
         {
             // Créer le depend
-            depend = new _Depend;
-            depend->type = type;
-            depend->op = op;
-            depend->pkgname = stringIndex(name, 0, false, false);
-            depend->pkgver = stringIndex(version, 0, false, false);
+            depend.type = type;
+            depend.op = op;
+            depend.pkgname = stringIndex(name, 0, false, false);
+            depend.pkgver = stringIndex(version, 0, false, false);
 
             depends[pkg->deps].append(depend);
 
@@ -359,7 +842,7 @@ void DatabaseWriter::revdep(_Package *pkg, const QByteArray &name, const QByteAr
 {
     // Explorer tous les paquets connus
     const QVector<knownEntry *> &entries = knownPackages.value(name);
-    _Depend *depend;
+    _Depend depend;
     
     foreach (knownEntry *entry, entries)
     {
@@ -367,19 +850,18 @@ void DatabaseWriter::revdep(_Package *pkg, const QByteArray &name, const QByteAr
         
         if (op == Depend::NoVersion || PackageSystem::matchVersion(entry->version, version, op))
         {
-            depend = new _Depend;
-            depend->type = type;
-            depend->op = Depend::Equal;
+            depend.type = type;
+            depend.op = Depend::Equal;
             
             if (type == Depend::RevDep)
             {
-                depend->pkgname = pkg->index;
-                depend->pkgver = 0;
+                depend.pkgname = pkg->index;
+                depend.pkgver = 0;
             }
             else
             {
-                depend->pkgname = pkg->name;
-                depend->pkgver = pkg->version;
+                depend.pkgname = pkg->name;
+                depend.pkgver = pkg->version;
             }
 
             // Ajouter la revdep au paquet cible
@@ -393,12 +875,28 @@ bool DatabaseWriter::rebuild()
     // On utilise 2 passes (d'abord créer les paquets, puis les manipuler)
     FileFile *currentDir = 0, *firstFile = 0;
     int pass;
-    QVector<char *> buffers;
-    char *buffer;
+    char *buffer, *fbuffer;
 
     strPtr = 0;
     transPtr = 0;
     fileStrPtr = 0;
+    freeArena();
+    
+    // La base de donnée va changer : une reconstruction interrompue ne doit pas
+    // garder l'ancienne empreinte
+    QString generationFile = parent->varRoot() + "/var/cache/lgrpkg/db/generation";
+    QByteArray oldGeneration;
+    
+    {
+        QFile fl(generationFile);
+        
+        if (fl.open(QIODevice::ReadOnly))
+        {
+            oldGeneration = fl.readAll();
+        }
+    }
+    
+    QFile::remove(generationFile);
 
     // Première étape
     int progress = parent->startProgress(Progress::UpdateDatabase, 7);
@@ -499,32 +997,16 @@ bool DatabaseWriter::rebuild()
                         err->info = fl.fileName();
                         
                         parent->setLastError(err);
-                        
-                        foreach(char *buf, buffers)
-                        {
-                            delete[] buf;
-                        }
-                        
                         return false;
                     }
                     
                     if (!verifySign(file + ".sig", fl.readAll(), signvalid))
                     {
-                        foreach(char *buf, buffers)
-                        {
-                            delete[] buf;
-                        }
-                        
                         return false;
                     }
                     
                     if (!signvalid)
                     {   
-                        foreach(char *buf, buffers)
-                        {
-                            delete[] buf;
-                        }
-                        
                         return false;
                     }
                 }
@@ -553,12 +1035,6 @@ bool DatabaseWriter::rebuild()
                 err->info = fname;
                 
                 parent->setLastError(err);
-                
-                foreach(char *buf, buffers)
-                {
-                    delete[] buf;
-                }
-                
                 return false;
             }
 
@@ -578,8 +1054,10 @@ bool DatabaseWriter::rebuild()
             fpos = 0;
             fd.seekg(0, ios::beg);
             
-            buffer = new char[flength];
-            buffers.append(buffer); //Pour deleter après
+            // Toutes les chaînes conservées sont copiées dans l'arène, le buffer
+            // n'est donc gardé que le temps de lire ce fichier
+            fbuffer = new char[flength];
+            buffer = fbuffer;
             fd.read(buffer, flength);
             
             fd.close();
@@ -592,21 +1070,13 @@ bool DatabaseWriter::rebuild()
             {
                 if (!verifySign(file + ".sig", QByteArray::fromRawData(buffer, flength), signvalid))
                 {
-                    foreach(char *buf, buffers)
-                    {
-                        delete[] buf;
-                    }
-                    
+                    delete[] fbuffer;
                     return false;
                 }
                 
                 if (!signvalid)
                 {   
-                    foreach(char *buf, buffers)
-                    {
-                        delete[] buf;
-                    }
-                    
+                    delete[] fbuffer;
                     return false;
                 }
             }
@@ -623,62 +1093,38 @@ bool DatabaseWriter::rebuild()
                 linelength = 0;
                 indexofequal = 0;
                 
-                if (datatype == PackagesList)
+                // Trouver la fin de la ligne. memchr est vectorisé par la libc, ce
+                // qui est bien plus rapide qu'une boucle octet par octet
+                const char *eol = (const char *)memchr(buffer, '\n', flength - fpos);
+                
+                linelength = (eol ? eol - buffer : flength - fpos);
+                buffer += linelength;
+                fpos += linelength;
+                
+                if (fpos < flength)
                 {
-                    // Trouver le égal, s'il existe
-                    while (fpos < flength && *buffer != '\n')
-                    {
-                        // Si la ligne contient un égal, le savoir
-                        if (!containsequal  && *buffer == '=')
-                        {
-                            containsequal = true;
-                            indexofequal = linelength;
-                        }
-                        else if (*buffer == '"')
-                        {
-                            hasquote = 1;
-                        }
-                            
-                        linelength++;
-                        buffer++;
-                        fpos++;
-                    }
+                    // Sauter le \n
+                    buffer++;
+                    fpos++;
                 }
-                else if (datatype == Translations)
+                
+                if (datatype == PackagesList || datatype == Translations)
                 {
-                    // Trouver le :, s'il existe
-                    while (fpos < flength && *buffer != '\n')
+                    // Trouver le séparateur (= ou :), s'il existe
+                    const char *sep = (const char *)memchr(cline, (datatype == PackagesList ? '=' : ':'), linelength);
+                    
+                    if (sep != 0)
                     {
-                        // Si la ligne contient un égal, le savoir
-                        if (!containsequal && *buffer == ':')
-                        {
-                            containsequal = true;
-                            indexofequal = linelength;
-                        }
-                            
-                        linelength++;
-                        buffer++;
-                        fpos++;
+                        containsequal = true;
+                        indexofequal = sep - cline;
                     }
-                }
-                else if (datatype == FilesList)
-                {
-                    // Avancer jusqu'à la fin de la ligne, on gère tout plus tard
-                    while (fpos < flength && *buffer != '\n')
+                    
+                    if (datatype == PackagesList && memchr(cline, '"', linelength) != 0)
                     {
-                        linelength++;
-                        buffer++;
-                        fpos++;
+                        hasquote = 1;
                     }
                 }
                 
-                if (fpos < flength)
-                {
-                    // Sauter le \n
-                    buffer++;
-                    fpos++;
-                }
-                
                 // Si la ligne est vide, continuer
                 if (linelength == 0) continue;
 
@@ -707,17 +1153,17 @@ bool DatabaseWriter::rebuild()
                     if (pkg == 0) continue;
 
                     // Lire les clefs et les valeurs
-                    QByteArray key = QByteArray::fromRawData(cline, indexofequal);
+                    ListKey key = listKey(cline, indexofequal);
                     QByteArray value = QByteArray::fromRawData(cline + indexofequal + 1 + hasquote, 
                                                                linelength - indexofequal - 1 - hasquote - hasquote);
                     
                     if (!ignorepackage)
                     {
-                        if (key == "Name")
+                        if (key == NameKey)
                         {
                             pkgname = value;
                         }
-                        else if (key == "Version")
+                        else if (key == VersionKey)
                         {
                             pkgver = value;
 
@@ -753,7 +1199,7 @@ bool DatabaseWriter::rebuild()
                                 // Ajouter le paquet aux listes, on peut maintenant
                                 pkg->deps = depends.count();
 
-                                depends.append(QVector<_Depend *>());
+                                depends.append(QVector<_Depend>());
 
                                 // Ajouter le paquet
                                 packages.append(pkg);
@@ -769,72 +1215,71 @@ bool DatabaseWriter::rebuild()
                                 }
                                 
                                 knownEntry *entry = new knownEntry;
-                                knownEntries.append(entry);
                                 
                                 entry->pkg = pkg;
                                 entry->version = value;
                                 entry->index = index;
                                 entry->ignore = false;
                                 
-                                knownPackages[pkgname].append(entry);
+                                addKnownEntry(pkgname, entry);
                             }
                             
                             pkg->version = stringIndex(value, index, false, false);
                             pkg->name = stringIndex(pkgname, index, false, !found);
                         }
-                        else if (key == "Source")
+                        else if (key == SourceKey)
                         {
                             pkg->source = stringIndex(value, index, false, false);
                         }
-                        else if (key == "Maintainer")
+                        else if (key == MaintainerKey)
                         {
                             pkg->maintainer = stringIndex(value, index, false, false);
                         }
-                        else if (key == "Distribution")
+                        else if (key == DistributionKey)
                         {
                             pkg->distribution = stringIndex(value, index, false, false);
                         }
-                        else if (key == "Section")
+                        else if (key == SectionKey)
                         {
                             pkg->section = stringIndex(value, index, false, false);
                         }
-                        else if (key == "UpstreamUrl")
+                        else if (key == UpstreamUrlKey)
                         {
                             pkg->uurl = stringIndex(value, index, false, false);
                         }
-                        else if (key == "License")
+                        else if (key == LicenseKey)
                         {
                             pkg->license = stringIndex(value, index, false, false);
                         }
-                        else if (key == "PackageHash")
+                        else if (key == PackageHashKey)
                         {
                             binaryHash = QByteArray::fromHex(value);
                             Q_ASSERT(binaryHash.size() == 20);
                             memcpy(&pkg->pkg_hash, binaryHash.data(), 20);
                         }
-                        else if (key == "MetadataHash")
+                        else if (key == MetadataHashKey)
                         {
                             binaryHash = QByteArray::fromHex(value);
                             Q_ASSERT(binaryHash.size() == 20);
                             memcpy(&pkg->mtd_hash, binaryHash.data(), 20);
                         }
-                        else if (key == "DownloadSize")
+                        else if (key == DownloadSizeKey)
                         {
                             pkg->dsize = value.toInt();
                         }
-                        else if (key == "InstallSize")
+                        else if (key == InstallSizeKey)
                         {
                             pkg->isize = value.toInt();
                         }
-                        else if (key == "Arch")
+                        else if (key == ArchKey)
                         {
                             pkg->arch = stringIndex(value, index, false, false);
                         }
-                        else if (key == "Flags")
+                        else if (key == FlagsKey)
                         {
                             pkg->flags = value.toInt();
                         }
-                        else if (key == "Provides" || key == "Replaces")
+                        else if (key == ProvidesKey || key == ReplacesKey)
                         {
                             // Insérer des knownPackages pour chaque provide
                             if (value.isEmpty())
@@ -860,40 +1305,40 @@ bool DatabaseWriter::rebuild()
 
                                 // Ajouter <dep>=<version> dans knownPackages
                                 knownEntry *entry = new knownEntry;
-                                knownEntries.append(entry);
                                 
                                 entry->pkg = pkg;
                                 entry->version = version;
                                 entry->index = index;
+                                entry->ignore = false;
                                 
-                                knownPackages[name].append(entry);
+                                addKnownEntry(name, entry);
                             }
                         }
                     }
 
                     if (isInstalledPackages)
                     {
-                        if (key == "InstalledDate")
+                        if (key == InstalledDateKey)
                         {
                             pkg->idate = value.toInt();
                         }
-                        else if (key == "InstalledRepo")
+                        else if (key == InstalledRepoKey)
                         {
                             pkg->repo = stringIndex(value, index, false, false);
                         }
-                        else if (key == "InstalledBy")
+                        else if (key == InstalledByKey)
                         {
                             pkg->iby = value.toInt();
                         }
-                        else if (key == "ShortDesc")
+                        else if (key == ShortDescKey)
                         {
                             pkg->short_desc = stringIndex(QByteArray::fromBase64(value), index, true, false);
                         }
-                        else if (key == "Flags")
+                        else if (key == FlagsKey)
                         {
                             pkg->flags = value.toInt();
                         }
-                        else if (key == "Used")
+                        else if (key == UsedKey)
                         {
                             pkg->used = value.toInt();
                         }
@@ -1182,13 +1627,13 @@ bool DatabaseWriter::rebuild()
                         if (ignorepackage) continue;
 
                         // Lire les clefs et les valeurs
-                        QByteArray key = QByteArray::fromRawData(cline, indexofequal);
+                        ListKey key = listKey(cline, indexofequal);
                         QByteArray value = QByteArray::fromRawData(cline + indexofequal + 1 + hasquote,
                                                                    linelength - indexofequal - 1 - hasquote - hasquote);
                         
                         if (value.isNull()) continue;
 
-                        if (key == "Version")
+                        if (key == VersionKey)
                         {
                             // Retrouver le paquet du bon nom et de la bonne version
                             const QVector<knownEntry *> &entries = knownPackages.value(name);
@@ -1205,24 +1650,24 @@ bool DatabaseWriter::rebuild()
                                 }
                             }
                         }
-                        if (key == "Depends")
+                        if (key == DependsKey)
                         {
                             setDepends(pkg, value, Depend::DependType);
                         }
-                        else if (key == "Suggest")
+                        else if (key == SuggestKey)
                         {
                             setDepends(pkg, value, Depend::Suggest);
                         }
-                        else if (key == "Conflicts")
+                        else if (key == ConflictsKey)
                         {
                             setDepends(pkg, value, Depend::Conflict);
                         }
-                        else if (key == "Provides" || key == "Replaces")
+                        else if (key == ProvidesKey || key == ReplacesKey)
                         {
                             // Quand on remplace un paquet, on le fournit
                             setDepends(pkg, value, Depend::Provide);
                             
-                            if (key == "Replaces")
+                            if (key == ReplacesKey)
                             {
                                 // Pour info et pour le solveur
                                 setDepends(pkg, value, Depend::Replace);
@@ -1259,6 +1704,8 @@ bool DatabaseWriter::rebuild()
                     }
                 }
             }
+            
+            delete[] fbuffer;
         }
     }
 
@@ -1300,6 +1747,27 @@ bool DatabaseWriter::rebuild()
             }
         }
     }
+    
+    // Version binaire des métadonnées, lue au démarrage par le gestionnaire d'applications.
+    // Recompilée pour les métadonnées téléchargées, mais aussi pour celles dont le cache
+    // manque ou a un ancien format (mise à jour de Logram, DATABASE_METADATA_VERSION)
+    QDir dbdir(parent->varRoot() + "/var/cache/lgrpkg/db");
+    
+    foreach (const QString &mdfile, dbdir.entryList(QStringList("*.metadata"), QDir::Files))
+    {
+        QString source = dbdir.filePath(mdfile);
+        QString cachename = source.section('.', 0, -2) + ".mdcache";
+        
+        if (metadataCacheUpToDate(source, cachename))
+        {
+            continue;
+        }
+        
+        if (!compileMetadata(source, cachename))
+        {
+            QFile::remove(cachename);
+        }
+    }
 
     //qDebug() << packages;
     //qDebug() << packagesIndexes;
@@ -1314,7 +1782,6 @@ bool DatabaseWriter::rebuild()
 
     /*** Écrire les listes dans les fichiers ***/
     int32_t length;
-    char zero = 0;
     
     // Liste des paquets
     if (!parent->sendProgress(progress, 1, tr("Génération de la liste des paquets")))
@@ -1322,9 +1789,52 @@ bool DatabaseWriter::rebuild()
         return false;
     }
     
+    // Version la plus récente de chaque paquet et paquets installés, pour
+    // DatabaseReader::upgradePackages() et DatabaseReader::orphans()
+    QHash<QPair<int32_t, int32_t>, int> newestIndexes;
+    QVector<int32_t> newest(packages.count(), -1);
+    QVector<uint32_t> installed((packages.count() + 31) / 32, 0);
+    
+    for (int i=0; i<packages.count(); ++i)
+    {
+        _Package *pkg = packages.at(i);
+        QPair<int32_t, int32_t> key(pkg->name, pkg->distribution);
+        int best = newestIndexes.value(key, -1);
+        
+        if (pkg->flags & Package::Installed)
+        {
+            installed[i / 32] |= (1U << (i % 32));
+        }
+        
+        if (best == -1 || compareStringVersions(stringsStrings, packages.at(best)->version, pkg->version) < 0)
+        {
+            newestIndexes.insert(key, i);
+        }
+    }
+    
+    for (int i=0; i<packages.count(); ++i)
+    {
+        _Package *pkg = packages.at(i);
+        _Package *bpkg;
+        int best = newestIndexes.value(qMakePair(pkg->name, pkg->distribution));
+        
+        if (best == i) continue;
+        
+        bpkg = packages.at(best);
+        
+        if (pkg->version != bpkg->version && compareStringVersions(stringsStrings, pkg->version, bpkg->version) < 0)
+        {
+            newest[i] = best;
+        }
+    }
+    
     QFile fl(parent->varRoot() +  "/var/cache/lgrpkg/db/packages");
+    
+    // Les enregistrements sont petits, les regrouper pour n'avoir que quelques
+    // appels système par fichier
+    BufferedWriter out(&fl);
 
-    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
     {
         PackageError *err = new PackageError;
         err->type = PackageError::OpenFileError;
@@ -1335,17 +1845,69 @@ bool DatabaseWriter::rebuild()
     }
 
     length = packages.count();
-    fl.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)&length, sizeof(int32_t));
+    
+    // Colonnes des champs les plus utilisés, voir _Columns
+    QVector<int32_t> columns(packages.count() * 3);
+    int32_t *cnames = columns.data();
+    int32_t *cversions = cnames + packages.count();
+    int32_t *cflags = cversions + packages.count();
 
     foreach (_Package *pkg, packages)
     {
         // Écrire le paquet
-        fl.write((const char *)pkg, sizeof(_Package));
+        out.write((const char *)pkg, sizeof(_Package));
+        
+        *cnames++ = pkg->name;
+        *cversions++ = pkg->version;
+        *cflags++ = pkg->flags;
         
         delete pkg;
     }
     
+    out.flush();
+    fl.close();
+    fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/columns");
+    
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+    {
+        PackageError *err = new PackageError;
+        err->type = PackageError::OpenFileError;
+        err->info = fl.fileName();
+        
+        parent->setLastError(err);
+        return false;
+    }
+    
+    _Columns colhdr;
+    colhdr.version = DATABASE_COLUMNS_VERSION;
+    colhdr.count = packages.count();
+    
+    out.write((const char *)&colhdr, sizeof(_Columns));
+    out.write((const char *)columns.constData(), columns.count() * sizeof(int32_t));
+    
+    // État des paquets
+    out.flush();
+    fl.close();
+    fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/states");
+    
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+    {
+        PackageError *err = new PackageError;
+        err->type = PackageError::OpenFileError;
+        err->info = fl.fileName();
+        
+        parent->setLastError(err);
+        return false;
+    }
+    
+    length = newest.count();
+    out.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)newest.constData(), newest.count() * sizeof(int32_t));
+    out.write((const char *)installed.constData(), installed.count() * sizeof(uint32_t));
+    
     // Liste des fichiers
+    out.flush();
     fl.close();
     if (!parent->sendProgress(progress, 2, tr("Enregistrement de la liste des fichiers")))
     {
@@ -1354,7 +1916,7 @@ bool DatabaseWriter::rebuild()
     
     fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/files");
     
-    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
     {
         PackageError *err = new PackageError;
         err->type = PackageError::OpenFileError;
@@ -1365,12 +1927,27 @@ bool DatabaseWriter::rebuild()
     }
     
     length = knownFiles.count(); // Nombre de fichiers dans la base
-    fl.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)&length, sizeof(int32_t));
     length = firstFile->index;   // Index du premier enfant du dossier racine
-    fl.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)&length, sizeof(int32_t));
     
     _File file;
     
+    // Fichiers portant chaque nom, pour l'index des noms. Les pointeurs des
+    // noms ont été attribués dans l'ordre de fileStrings par fileStringIndex()
+    QHash<int, int> nameOrdinals;
+    QVector<int> namePtrs;
+    QVector<QVector<int> > namesFiles(fileStrings.count());
+    int nptr = 0;
+    
+    for (int i=0; i<fileStrings.count(); ++i)
+    {
+        nameOrdinals.insert(nptr, i);
+        namePtrs.append(nptr);
+        
+        nptr += fileStrings.at(i).length() + 1;
+    }
+    
     foreach (FileFile *mfile, knownFiles)
     {
         file.package = mfile->package_index;
@@ -1403,7 +1980,12 @@ bool DatabaseWriter::rebuild()
         }
         
         // Écriture
-        fl.write((const char *)&file, sizeof(_File));
+        out.write((const char *)&file, sizeof(_File));
+        
+        if ((mfile->flags & PackageFile::Directory) == 0)
+        {
+            namesFiles[nameOrdinals.value(mfile->name_index)].append(mfile->index);
+        }
     }
     
     foreach (FileFile *mfile, knownFiles)
@@ -1414,11 +1996,90 @@ bool DatabaseWriter::rebuild()
     for (int i=0; i<fileStrings.count(); ++i)
     {
         const QByteArray &str = fileStrings.at(i);
-        fl.write(str.constData(), str.length());
-        fl.write(&zero, 1);
+        out.writeString(str);
+    }
+    
+    // Index des noms de fichiers, utilisé par DatabaseReader::files(QRegExp)
+    out.flush();
+    fl.close();
+    fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/fileindex");
+    
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
+    {
+        PackageError *err = new PackageError;
+        err->type = PackageError::OpenFileError;
+        err->info = fl.fileName();
+        
+        parent->setLastError(err);
+        return false;
+    }
+    
+    QVector<int> sortedNames, reversedNames;
+    QVector<int> namePositions(fileStrings.count());
+    QList<QByteArray> reversedStrings;
+    
+    for (int i=0; i<fileStrings.count(); ++i)
+    {
+        // Seuls les noms portés par des fichiers sont indexés, pas ceux des dossiers
+        if (namesFiles.at(i).isEmpty())
+        {
+            reversedStrings.append(QByteArray());
+            continue;
+        }
+        
+        const QByteArray &str = fileStrings.at(i);
+        QByteArray rev(str.length(), '\0');
+        
+        for (int j=0; j<str.length(); ++j)
+        {
+            rev[str.length() - 1 - j] = str.at(j);
+        }
+        
+        reversedStrings.append(rev);
+        sortedNames.append(i);
+    }
+    
+    qSort(sortedNames.begin(), sortedNames.end(), NameLessThan(&fileStrings));
+    reversedNames = sortedNames;
+    qSort(reversedNames.begin(), reversedNames.end(), NameLessThan(&reversedStrings));
+    
+    for (int i=0; i<sortedNames.count(); ++i)
+    {
+        namePositions[sortedNames.at(i)] = i;
+    }
+    
+    length = sortedNames.count();
+    out.write((const char *)&length, sizeof(int32_t));
+    
+    _FileName fn;
+    int fnptr = 0;
+    
+    foreach (int i, sortedNames)
+    {
+        fn.name_ptr = namePtrs.at(i);
+        fn.ptr = fnptr;
+        fn.count = namesFiles.at(i).count();
+        
+        out.write((const char *)&fn, sizeof(_FileName));
+        
+        fnptr += fn.count * sizeof(int32_t);
+    }
+    
+    foreach (int i, reversedNames)
+    {
+        length = namePositions.at(i);
+        out.write((const char *)&length, sizeof(int32_t));
+    }
+    
+    foreach (int i, sortedNames)
+    {
+        const QVector<int> &l = namesFiles.at(i);
+        
+        out.write((const char *)l.constData(), l.count() * sizeof(int32_t));
     }
 
     // Chaînes de caractères
+    out.flush();
     fl.close();
     if (!parent->sendProgress(progress, 3, tr("Écriture des chaînes de caractère")))
     {
@@ -1427,7 +2088,7 @@ bool DatabaseWriter::rebuild()
     
     fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/strings");
 
-    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
     {
         PackageError *err = new PackageError;
         err->type = PackageError::OpenFileError;
@@ -1438,25 +2099,18 @@ bool DatabaseWriter::rebuild()
     }
 
     length = strings.count();
-    fl.write((const char *)&length, sizeof(int32_t));
-    
-    foreach (_String *str, strings)
-    {
-        // Ecrire la chaine
-        fl.write((const char *)str, sizeof(_String));
-        
-        delete str;
-    }
+    out.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)strings.constData(), strings.count() * sizeof(_String));
 
     for (int i=0; i<strings.count(); ++i)
     {
         // On écrit maintenant les valeurs
         const QByteArray &str = stringsStrings.at(i);
-        fl.write(str.constData(), str.length());
-        fl.write(&zero, 1);
+        out.writeString(str);
     }
 
     // Chaînes traduites
+    out.flush();
     fl.close();
     if (!parent->sendProgress(progress, 4, tr("Écriture des traductions")))
     {
@@ -1465,7 +2119,7 @@ bool DatabaseWriter::rebuild()
     
     fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/translate");
 
-    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
     {
         PackageError *err = new PackageError;
         err->type = PackageError::OpenFileError;
@@ -1476,25 +2130,18 @@ bool DatabaseWriter::rebuild()
     }
 
     length = translate.count();
-    fl.write((const char *)&length, sizeof(int32_t));
-
-    foreach (_String *str, translate)
-    {
-        // Ecrire la chaine
-        fl.write((const char *)str, sizeof(_String));
-        
-        delete str;
-    }
+    out.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)translate.constData(), translate.count() * sizeof(_String));
 
     for (int i=0; i<translate.count(); ++i)
     {
         // On écrit maintenant les valeurs
         const QByteArray &str = translateStrings.at(i);
-        fl.write(str.constData(), str.length());
-        fl.write(&zero, 1);
+        out.writeString(str);
     }
 
     // Dépendances
+    out.flush();
     fl.close();
     if (!parent->sendProgress(progress, 5, tr("Enregistrement des dépendances")))
     {
@@ -1503,7 +2150,7 @@ bool DatabaseWriter::rebuild()
     
     fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/depends");
 
-    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
     {
         PackageError *err = new PackageError;
         err->type = PackageError::OpenFileError;
@@ -1514,36 +2161,31 @@ bool DatabaseWriter::rebuild()
     }
 
     length = depends.count();
-    fl.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)&length, sizeof(int32_t));
 
     _DependPtr dp;
     int dptr = 0;
 
-    QVector<_Depend *> alldeps;
-
-    foreach (const QVector<_Depend *> &l, depends)
+    foreach (const QVector<_Depend> &l, depends)
     {
         // Ecrire le tableau des dépendances
         dp.count = l.count();
         dp.ptr = dptr;
 
-        fl.write((const char *)&dp, sizeof(_DependPtr));
+        out.write((const char *)&dp, sizeof(_DependPtr));
 
         // Adapter le pointeur
         dptr += l.count() * sizeof(_Depend);
-
-        // Pour aller plus vite, déjà ajouter cette dépendance
-        alldeps << l;
     }
 
-    foreach(_Depend *dep, alldeps)
+    // Les dépendances de chaque paquet sont contiguës, les écrire en un bloc
+    foreach (const QVector<_Depend> &l, depends)
     {
-        fl.write((const char *)dep, sizeof(_Depend));
-        
-        delete dep;
+        out.write((const char *)l.constData(), l.count() * sizeof(_Depend));
     }
 
     // StrPackages
+    out.flush();
     fl.close();
     if (!parent->sendProgress(progress, 6, tr("Enregistrement des données supplémentaires")))
     {
@@ -1552,7 +2194,7 @@ bool DatabaseWriter::rebuild()
     
     fl.setFileName(parent->varRoot() + "/var/cache/lgrpkg/db/strpackages");
 
-    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered))
     {
         PackageError *err = new PackageError;
         err->type = PackageError::OpenFileError;
@@ -1563,46 +2205,54 @@ bool DatabaseWriter::rebuild()
     }
 
     length = strPackages.count();
-    fl.write((const char *)&length, sizeof(int32_t));
+    out.write((const char *)&length, sizeof(int32_t));
 
     _StrPackagePtr spp;
     int spptr = 0;
 
-    QVector<_StrPackage *> allsp;
-
-    foreach (const QVector<_StrPackage *> &l, strPackages)
+    foreach (const QVector<_StrPackage> &l, strPackages)
     {
         // Ecrire le tableau des dépendances
         spp.count = l.count();
         spp.ptr = spptr;
 
-        fl.write((const char *)&spp, sizeof(_StrPackagePtr));
+        out.write((const char *)&spp, sizeof(_StrPackagePtr));
 
         // Adapter le pointeur
         spptr += l.count() * sizeof(_StrPackage);
-
-        // Pour aller plus vite, déjà ajouter cette dépendance
-        allsp << l;
     }
 
-    foreach(_StrPackage *sp, allsp)
+    foreach (const QVector<_StrPackage> &l, strPackages)
     {
-        fl.write((const char *)sp, sizeof(_StrPackage));
-        
-        delete sp;
+        out.write((const char *)l.constData(), l.count() * sizeof(_StrPackage));
     }
 
     // Fermer le fichier
+    out.flush();
     fl.close();
     
-    // Librérer les buffers
-    foreach(char *buf, buffers)
+    // Nouvelle empreinte de la base de donnée, jamais la même d'une reconstruction
+    // à l'autre, même dans la même seconde
+    QCryptographicHash stamp(QCryptographicHash::Sha1);
+    
+    stamp.addData(oldGeneration);
+    stamp.addData(QByteArray::number(QDateTime::currentDateTime().toTime_t()) + ' ' +
+                  QByteArray::number(QTime::currentTime().msec()) + ' ' +
+                  QByteArray::number((qint64)getpid()) + ' ' +
+                  QByteArray::number(qrand()));
+    
+    fl.setFileName(generationFile);
+    
+    if (fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
     {
-        delete[] buf;
+        fl.write(stamp.result().toHex());
+        fl.close();
     }
     
     // Nettoyer
     qDeleteAll(knownEntries);
+    knownEntries.clear();
+    freeArena();
 
     // On a fini ! :-)
     parent->endProgress(progress);
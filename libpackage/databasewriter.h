@@ -36,6 +36,7 @@
 #include <QByteArray>
 
 #include "packagesystem.h"
+#include "databaseformat.h"
 
 class QNetworkAccessManager;
 class QNetworkReply;
@@ -47,11 +48,6 @@ namespace Logram {
     
 class PackageSystem;
 
-struct _String;
-struct _Package;
-struct _StrPackage;
-struct _Depend;
-
 /**
     @brief Entrée de paquet connue
     
@@ -97,6 +93,11 @@ class DatabaseWriter : public QObject
         */
         DatabaseWriter(PackageSystem *_parent);
         
+        /**
+            @brief Destructeur
+        */
+        ~DatabaseWriter();
+        
         /**
          * @brief Type de fichier téléchargé
          * @sa download
@@ -134,8 +135,8 @@ class DatabaseWriter : public QObject
         QVector<_Package *> packages;
         
         //QHash<int, int> packagesIndexes;
-        QVector<_String *> strings;
-        QVector<_String *> translate;
+        QVector<_String> strings;
+        QVector<_String> translate;
         QHash<QByteArray, int> stringsIndexes;
         QHash<QByteArray, int> translateIndexes;
         QHash<QByteArray, int> fileStringsPtrs;
@@ -145,14 +146,23 @@ class DatabaseWriter : public QObject
 
         int strPtr, transPtr, fileStrPtr;
 
-        QList<QVector<_StrPackage *> > strPackages;
-        QList<QVector<_Depend *> > depends;
+        QVector<QVector<_StrPackage> > strPackages;
+        QVector<QVector<_Depend> > depends;
+        
+        // Arène : toutes les chaînes conservées y sont copiées, ce qui permet
+        // de libérer le buffer d'une liste dès qu'elle est lue
+        QVector<char *> arenaBlocks;
+        char *arenaPos;
+        int arenaFree;
         
         QHash<QByteArray, QVector<knownEntry *> > knownPackages; // (nom, [(version, _Package)])
         QVector<knownEntry *> knownEntries;
         QVector<FileFile *> knownFiles;
 
         void handleDl(QIODevice *device);
+        QByteArray intern(const QByteArray &str);
+        void freeArena();
+        void addKnownEntry(const QByteArray &name, knownEntry *entry);
         int stringIndex(const QByteArray &str, int pkg, bool isTr, bool create = true);
         int fileStringIndex(const QByteArray &str);
         void setDepends(_Package *pkg, const QByteArray &str, int type);
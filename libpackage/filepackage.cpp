@@ -32,6 +32,8 @@
 #include <QLocale>
 #include <QDir>
 #include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
 
 #include <QtDebug>
 #include <QtXml>
@@ -40,16 +42,29 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include <errno.h>
+
 using namespace Logram;
 
+// Début des index des paquets, dans /var/cache/lgrpkg/db/lpk
+#define FILEPACKAGE_INDEX_MAGIC 0x4C504B31
+
+// Nombre maximal d'index gardés, les plus anciens sont supprimés au-delà
+#define FILEPACKAGE_INDEX_MAX 1024
+
 struct FilePackage::Private
 {
     PackageSystem *ps;
     QString fileName;
     bool valid;
+    bool useIndex;      // Voir FilePackage::setUseIndex()
+    bool archiveRead;   // True si l'archive ou son index a été lu (readContents())
+    bool checked;       // True si l'archive a été vérifiée par isValid() (checkArchive())
+    bool loaded;        // True si les informations du paquet ont été chargées (loadContents())
     
     int flags;
     qint64 size, isize;
+    uint mtime;
     QString name;
     QString version;
     QString maintainer;
@@ -63,6 +78,7 @@ struct FilePackage::Private
     QString primaryLang;
     
     QVector<PackageFile *> files;
+    QStringList dataFiles;
     QByteArray metadataContents;
     
     QByteArray packageHash, metadataHash;
@@ -70,6 +86,14 @@ struct FilePackage::Private
     QVector<Depend *> depends;
     
     void addDeps(const QByteArray& str, Depend::Type type);
+    
+    QString indexFile() const;
+    bool readIndexHeader(QDataStream &in) const;
+    bool readIndex(QStringList &dataFiles);
+    void writeIndex(const QStringList &dataFiles);
+    bool readArchive(QStringList &dataFiles);
+    void readContents();
+    bool checkArchive();
 };
 
 /**** FileFile ****/
@@ -137,11 +161,76 @@ void FileFile::setInstallTime(uint timestamp)
 
 /**** FilePackage ****/
 
+// Lit un paquet pour libarchive par blocs de taille fixe, en calculant son hash au passage
+struct HashingReader
+{
+    HashingReader(const QString &fileName) : file(fileName), hash(QCryptographicHash::Sha1), buffer(65536, 0) {}
+    
+    QByteArray finish()
+    {
+        qint64 len;
+        
+        while ((len = file.read(buffer.data(), buffer.size())) > 0)
+        {
+            hash.addData(buffer.constData(), len);
+        }
+        
+        file.close();
+        
+        return hash.result();
+    }
+    
+    QFile file;
+    QCryptographicHash hash;
+    QByteArray buffer;
+};
+
+static ssize_t hashingRead(struct archive *a, void *client, const void **buff)
+{
+    HashingReader *reader = (HashingReader *)client;
+    qint64 len = reader->file.read(reader->buffer.data(), reader->buffer.size());
+    
+    if (len < 0)
+    {
+        archive_set_error(a, EIO, "%s", qPrintable(reader->file.errorString()));
+        return -1;
+    }
+    
+    reader->hash.addData(reader->buffer.constData(), len);
+    *buff = reader->buffer.constData();
+    
+    return len;
+}
+
+static int hashingClose(struct archive *a, void *client)
+{
+    // Le fichier est fermé par HashingReader::finish(), après la lecture de ce que libarchive a laissé
+    (void) a;
+    (void) client;
+    
+    return ARCHIVE_OK;
+}
+
 FilePackage::FilePackage(const QString &fileName, PackageSystem *ps, DatabaseReader *psd, Solver::Action _action)
     : Package(ps, psd, _action)
 {
     d = new Private;
     d->ps = ps;
+    
+    load(fileName);
+}
+
+FilePackage::FilePackage(QObject *parent, const QString &fileName, PackageSystem *ps, DatabaseReader *psd, Solver::Action _action)
+    : Package(parent, ps, psd, _action)
+{
+    d = new Private;
+    d->ps = ps;
+    
+    load(fileName);
+}
+
+void FilePackage::load(const QString &fileName)
+{
     d->isize = 0;
     d->flags = 0;
     
@@ -153,7 +242,6 @@ FilePackage::FilePackage(const QString &fileName, PackageSystem *ps, DatabaseRea
     {
         d->fileName = QDir::currentPath() + "/" + fileName;
     }
-    d->valid = true;
     
     // Architecture et taille
     d->arch = fileName.section('.', -2, -2);
@@ -163,45 +251,140 @@ FilePackage::FilePackage(const QString &fileName, PackageSystem *ps, DatabaseRea
     d->name = fileName.section('/', -1, -1).section('~', 0, 0);
     d->version = fileName.section('/', -1, -1).section('~', 1, -1).section('.', 0, -3);
     
-    // Hash du paquet
-    QFile fl(fileName);
+    d->mtime = fi.lastModified().toTime_t();
+    d->valid = fi.isFile();
+    
+    // Le contenu de l'archive n'est lu que lorsqu'on en a besoin, voir loadContents()
+    d->useIndex = true;
+    d->archiveRead = false;
+    d->checked = false;
+    d->loaded = false;
+}
+
+QString FilePackage::Private::indexFile() const
+{
+    QByteArray key = QCryptographicHash::hash(fileName.toUtf8(), QCryptographicHash::Sha1).toHex();
     
-    if (fl.open(QIODevice::ReadOnly))
+    return ps->varRoot() + "/var/cache/lgrpkg/db/lpk/" + key;
+}
+
+bool FilePackage::Private::readIndexHeader(QDataStream &in) const
+{
+    quint32 magic, imtime;
+    qint64 fsize;
+    
+    in.setVersion(QDataStream::Qt_4_5);
+    in >> magic >> fsize >> imtime;
+    
+    // L'index n'est valable que si le paquet n'a pas changé depuis
+    return (in.status() == QDataStream::Ok && magic == FILEPACKAGE_INDEX_MAGIC && fsize == size && imtime == mtime);
+}
+
+bool FilePackage::Private::readIndex(QStringList &dataFiles)
+{
+    QFile fl(indexFile());
+    
+    if (!fl.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    
+    QDataStream in(&fl);
+    qint64 isize_;
+    
+    if (!readIndexHeader(in))
+    {
+        return false;
+    }
+    
+    in >> packageHash >> isize_ >> dataFiles >> metadataContents;
+    
+    if (in.status() != QDataStream::Ok)
     {
-        d->packageHash = QCryptographicHash::hash(fl.readAll(), QCryptographicHash::Sha1);
+        dataFiles.clear();
+        packageHash.clear();
+        metadataContents.clear();
         
-        fl.close();
+        return false;
     }
     
-    // Lire l'archive .tar.tlz qu'est un paquet, et récupérer les métadonnées et le fichier .control
+    isize = isize_;
+    
+    return true;
+}
+
+void FilePackage::Private::writeIndex(const QStringList &dataFiles)
+{
+    QString fileName = indexFile();
+    QDir dir(fileName.section('/', 0, -2));
+    
+    dir.mkpath(dir.path());
+    
+    // Borner le nombre d'index : un par chemin de paquet lu, sinon le dossier grandirait
+    // indéfiniment. Les plus anciens sont supprimés, il en reste les trois quarts.
+    QFileInfoList entries = dir.entryInfoList(QDir::Files, QDir::Time);
+    
+    if (entries.count() >= FILEPACKAGE_INDEX_MAX)
+    {
+        for (int i=FILEPACKAGE_INDEX_MAX * 3 / 4; i<entries.count(); ++i)
+        {
+            QFile::remove(entries.at(i).absoluteFilePath());
+        }
+    }
+    
+    QFile fl(fileName);
+    
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        // Pas grave, l'archive sera simplement relue la prochaine fois
+        return;
+    }
+    
+    QDataStream out(&fl);
+    
+    out.setVersion(QDataStream::Qt_4_5);
+    out << (quint32)FILEPACKAGE_INDEX_MAGIC << size << (quint32)mtime;
+    out << packageHash << isize << dataFiles << metadataContents;
+}
+
+bool FilePackage::Private::readArchive(QStringList &dataFiles)
+{
+    // Lire l'archive .tar.tlz qu'est un paquet, et récupérer les métadonnées et le fichier .control.
+    // Le hash du paquet est calculé sur les blocs lus par libarchive, le fichier n'est lu qu'une fois
+    HashingReader reader(fileName);
     struct archive *a;
     struct archive_entry *entry;
     int r;
     
+    if (!reader.file.open(QIODevice::ReadOnly))
+    {
+        valid = false;
+        return false;
+    }
+    
     a = archive_read_new();
     archive_read_support_compression_lzma(a);
     archive_read_support_compression_xz(a);
     archive_read_support_format_all(a);
     
-    r = archive_read_open_filename(a, qPrintable(fileName), 10240);
+    r = archive_read_open(a, &reader, NULL, hashingRead, hashingClose);
     
     if (r != ARCHIVE_OK)
     {
-        d->valid = false;
-        return;
+        archive_read_finish(a);
+        valid = false;
+        return false;
     }
     
     // Lire les entrées
     QByteArray path;
-    int size;
+    int esize;
     char *buffer;
     
-    QString lang = QLocale::system().name().section('_', 0, 0);
-    
     while (archive_read_next_header(a, &entry) == ARCHIVE_OK)
     {
         path = QByteArray(archive_entry_pathname(entry));
-        d->isize += archive_entry_size(entry);
+        isize += archive_entry_size(entry);
         
         if (path.startsWith("data/"))
         {
@@ -214,25 +397,18 @@ FilePackage::FilePackage(const QString &fileName, PackageSystem *ps, DatabaseRea
             }
             
             path.remove(0, 5);
-            FileFile *file = new FileFile(d->ps, path, (PackageFile::Flag)0);
-            
-            if (path.startsWith("etc"))
-            {
-                file->setFlagsNoSave(PackageFile::CheckBackup);
-            }
-            
-            d->files.append(file);
+            dataFiles.append(path);
         }
         
         // Savoir quel type de fichier on a lu
         if (path == "control/metadata.xml")
         {
             // Lire le fichier
-            size = archive_entry_size(entry);
-            buffer = new char[size];
-            archive_read_data(a, buffer, size);
+            esize = archive_entry_size(entry);
+            buffer = new char[esize];
+            archive_read_data(a, buffer, esize);
             
-            d->metadataContents = QByteArray(buffer, size);
+            metadataContents = QByteArray(buffer, esize);
             
             delete[] buffer;
         }
@@ -242,7 +418,101 @@ FilePackage::FilePackage(const QString &fileName, PackageSystem *ps, DatabaseRea
     
     if (r != ARCHIVE_OK)
     {
-        d->valid = false;
+        valid = false;
+    }
+    
+    // Hash du paquet : libarchive a pu s'arrêter avant la fin du fichier
+    packageHash = reader.finish();
+    
+    return true;
+}
+
+void FilePackage::Private::readContents()
+{
+    if (archiveRead)
+    {
+        return;
+    }
+    
+    archiveRead = true;
+    
+    // Un index à jour évite de décompresser l'archive
+    if (!useIndex || !readIndex(dataFiles))
+    {
+        if (!readArchive(dataFiles))
+        {
+            return;
+        }
+        
+        if (valid && useIndex)
+        {
+            writeIndex(dataFiles);
+        }
+    }
+}
+
+bool FilePackage::Private::checkArchive()
+{
+    // Un index à jour n'est écrit que pour une archive valide
+    if (useIndex)
+    {
+        QFile fl(indexFile());
+        
+        if (fl.open(QIODevice::ReadOnly))
+        {
+            QDataStream in(&fl);
+            
+            if (readIndexHeader(in))
+            {
+                return true;
+            }
+        }
+    }
+    
+    // Sinon, seul le premier en-tête de l'archive est lu
+    struct archive *a;
+    struct archive_entry *entry;
+    bool rs;
+    
+    a = archive_read_new();
+    archive_read_support_compression_lzma(a);
+    archive_read_support_compression_xz(a);
+    archive_read_support_format_all(a);
+    
+    rs = (archive_read_open_filename(a, QFile::encodeName(fileName).constData(), 10240) == ARCHIVE_OK &&
+          archive_read_next_header(a, &entry) == ARCHIVE_OK);
+    
+    archive_read_finish(a);
+    
+    return rs;
+}
+
+void FilePackage::loadContents()
+{
+    if (d->loaded)
+    {
+        return;
+    }
+    
+    d->loaded = true;
+    d->readContents();
+    
+    // Archive illisible, rien à charger
+    if (d->dataFiles.isEmpty() && d->metadataContents.isEmpty())
+    {
+        return;
+    }
+    
+    foreach (const QString &path, d->dataFiles)
+    {
+        FileFile *file = new FileFile(d->ps, path, (PackageFile::Flag)0);
+        
+        if (path.startsWith("etc"))
+        {
+            file->setFlagsNoSave(PackageFile::CheckBackup);
+        }
+        
+        d->files.append(file);
     }
     
     // Créer la template qui sera utilisée pour la suite
@@ -252,8 +522,9 @@ FilePackage::FilePackage(const QString &fileName, PackageSystem *ps, DatabaseRea
     tpl.addKey("package", d->name);
     tpl.addKey("arch", d->arch);
     
-    // Charger les informations contenues dans les métadonnées
-    PackageMetaData doc(ps);
+    // Charger les informations contenues dans les métadonnées. Pas de parent,
+    // le paquet peut être chargé depuis un autre thread (RepositoryManager::includePackages())
+    PackageMetaData doc(d->ps, 0);
     doc.loadData(d->metadataContents);
     
     d->primaryLang = doc.primaryLang();
@@ -266,6 +537,8 @@ FilePackage::FilePackage(const QString &fileName, PackageSystem *ps, DatabaseRea
     }
     
     // Attributs du paquet
+    doc.ensureParsed();
+    
     QDomElement package = doc.documentElement().firstChildElement();
     
     while (!package.isNull())
@@ -436,9 +709,15 @@ FilePackage::FilePackage(const FilePackage &other) : Package(other)
     d->ps = other.d->ps;
     d->fileName = other.d->fileName;
     d->valid = other.d->valid;
+    d->useIndex = other.d->useIndex;
+    d->archiveRead = other.d->archiveRead;
+    d->checked = other.d->checked;
+    d->loaded = other.d->loaded;
     
     d->flags = other.d->flags;
     d->size = other.d->size;
+    d->isize = other.d->isize;
+    d->mtime = other.d->mtime;
     d->name = other.d->name;
     d->version = other.d->version;
     d->maintainer = other.d->maintainer;
@@ -450,7 +729,11 @@ FilePackage::FilePackage(const FilePackage &other) : Package(other)
     d->arch = other.d->arch;
     d->primaryLang = other.d->primaryLang;
     
+    d->upstream_url = other.d->upstream_url;
+    d->dataFiles = other.d->dataFiles;
     d->metadataContents = other.d->metadataContents;
+    d->packageHash = other.d->packageHash;
+    d->metadataHash = other.d->metadataHash;
     
     foreach(Depend *dep, other.d->depends)
     {
@@ -521,8 +804,23 @@ QString FilePackage::tlzFileName()
     return d->fileName;
 }
 
+void FilePackage::setUseIndex(bool enable)
+{
+    d->useIndex = enable;
+}
+
 bool FilePackage::isValid()
 {
+    // Vérification rapide : le contenu de l'archive n'est décompressé que par
+    // loadContents(). Si c'est déjà fait, son résultat est plus sûr
+    if (!d->valid || d->archiveRead || d->checked)
+    {
+        return d->valid;
+    }
+    
+    d->checked = true;
+    d->valid = d->checkArchive();
+    
     return d->valid;
 }
 
@@ -533,6 +831,8 @@ Package::Origin FilePackage::origin()
 
 QVector<PackageFile *> FilePackage::files()
 {
+    loadContents();
+    
     return d->files;
 }
 
@@ -548,21 +848,29 @@ QString FilePackage::version()
 
 QString FilePackage::maintainer()
 {
+    loadContents();
+    
     return d->maintainer;
 }
 
 QString FilePackage::shortDesc()
 {
+    loadContents();
+    
     return d->shortDesc;
 }
 
 QString FilePackage::source()
 {
+    loadContents();
+    
     return d->source;
 }
 
 QString FilePackage::upstreamUrl()
 {
+    loadContents();
+    
     return d->upstream_url;
 }
 
@@ -573,16 +881,22 @@ QString FilePackage::repo()
 
 QString FilePackage::section()
 {
+    loadContents();
+    
     return d->section;
 }
 
 QString FilePackage::distribution()
 {
+    loadContents();
+    
     return d->distribution;
 }
 
 QString FilePackage::license()
 {
+    loadContents();
+    
     return d->license;
 }
 
@@ -593,16 +907,22 @@ QString FilePackage::arch()
 
 QByteArray FilePackage::packageHash()
 {
+    loadContents();
+    
     return d->packageHash;
 }
 
 QByteArray FilePackage::metadataHash()
 {
+    loadContents();
+    
     return d->metadataHash;
 }
 
 Package::Flag FilePackage::flags()
 {
+    loadContents();
+    
     return (Flag)d->flags;
 }
 
@@ -643,11 +963,15 @@ int FilePackage::downloadSize()
 
 int FilePackage::installSize()
 {
+    loadContents();
+    
     return d->isize;
 }
 
 QVector<Depend *> FilePackage::depends()
 {
+    loadContents();
+    
     return d->depends;
 }
 
@@ -661,6 +985,8 @@ void FilePackage::registerState(int idate, int iby, Package::Flag flags)
 
 QByteArray FilePackage::metadataContents()
 {
+    loadContents();
+    
     return d->metadataContents;
 }
 
@@ -50,6 +50,11 @@ class FileDepend;
     
     RepositoryManager se sert de cette classe pour importer les paquets
     
+    Le nom, la version et l'architecture sont tirés du nom du fichier. L'archive
+    n'est lue qu'au premier appel d'une fonction qui a besoin de son contenu, et
+    un index de ce contenu est gardé dans /var/cache/lgrpkg/db/lpk pour ne pas
+    la décompresser à nouveau tant que le fichier ne change pas
+    
     @note Ses membres sont les mêmes que Package, et ne sont donc pas 
         documentés, à l'exception de certains qui ont des paramètres
         différents
@@ -67,11 +72,47 @@ class FilePackage : public Package
             @param _action Action, passé à Package::Package
         */
         FilePackage(const QString &fileName, PackageSystem *ps, DatabaseReader *psd, Solver::Action _action = Solver::None);
+        
+        /**
+            @brief Constructeur avec un parent explicite
+            
+            Ce constructeur ne touche à aucun QObject appartenant à @p ps, et
+            peut donc être appelé depuis un autre thread avec @p parent à 0.
+            Le paquet doit ensuite être déplacé dans le thread de @p ps
+            (QObject::moveToThread()).
+            
+            @param parent QObject parent
+            @param fileName Nom du fichier .tlz
+            @param ps PackageSystem utilisé
+            @param psd Lecteur de base de donnée utilisé
+            @param _action Action, passé à Package::Package
+        */
+        FilePackage(QObject *parent, const QString &fileName, PackageSystem *ps, DatabaseReader *psd, Solver::Action _action = Solver::None);
         FilePackage(const FilePackage &other);  /*!< @brief Constructeur de copie nécessaire pour la gestion du solveur */
         ~FilePackage();
 
+        /**
+            @brief Définit si l'index de /var/cache/lgrpkg/db/lpk est utilisé (@b true par défaut)
+            
+            L'index n'est valable que si la taille et la date du fichier n'ont
+            pas changé. Un paquet reconstruit à la même place puis copié avec
+            sa date (rsync -t) peut tromper ce test : RepositoryManager, qui
+            publie le hash des paquets, désactive donc l'index.
+            
+            @note À appeler avant toute fonction qui lit le contenu de l'archive
+        */
+        void setUseIndex(bool enable);
+        
         bool download();            /*!< @brief Renvoie immédiatement true et émmet immédiatement downloaded() */
         QString tlzFileName();
+        
+        /**
+            @brief Vérifie que le paquet est lisible
+            
+            Seul l'en-tête de l'archive est lu, ou l'index s'il est à jour.
+            Une archive corrompue plus loin n'est détectée qu'une fois son
+            contenu lu (metadataContents(), files(), etc).
+        */
         bool isValid();
         Package::Origin origin();   /*!< @brief Renvoie Package::File */
         
@@ -112,6 +153,9 @@ class FilePackage : public Package
         void downloaded(bool success);
 
     private:
+        void load(const QString &fileName);
+        void loadContents();
+        
         struct Private;
         Private *d;
 };
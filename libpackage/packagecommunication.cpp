@@ -69,6 +69,8 @@ PackageCommunication::PackageCommunication(PackageSystem *ps, PackageMetaData *m
     }
     
     // Trouver l'élément de la communication
+    d->md->ensureParsed();
+    
     QDomElement comm = d->md->documentElement().firstChildElement("communication");
     
     while (!comm.isNull())
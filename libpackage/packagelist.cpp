@@ -33,6 +33,9 @@
 #include <QEventLoop>
 #include <QFile>
 #include <QSettings>
+#include <QHash>
+#include <QSet>
+#include <QThread>
 
 using namespace Logram;
 
@@ -55,6 +58,14 @@ struct PackageList::Private
     QList<Package *> downloadedPackages;
     QVector<int> orphans;
     QList<QString> triggers;
+    QHash<QString, QString> triggerGroups;  // trigger => groupe, vide si le trigger n'en a pas
+    
+    // Lancement des triggers
+    Templatable *tpl;
+    QList<QStringList> triggerQueues;       // Triggers restant à lancer, un QStringList par groupe
+    QSet<int> runningGroups;
+    int runningTriggers, startedTriggers, triggerProgress;
+    bool triggerError;
     
     QFile safeRemoveList;
     QMutex safeRemoveMutex;
@@ -68,6 +79,7 @@ PackageList::PackageList(PackageSystem *ps) : QObject(ps), QVector<Package *>()
     d->deletePackagesOnDelete = true;
     d->numLicenses = 0;
     d->ps = ps;
+    d->tpl = 0;
     
     d->parallelInstalls = ps->parallelInstalls();
     d->parallelDownloads = ps->parallelDownloads();
@@ -205,6 +217,7 @@ bool PackageList::process()
             if (!d->triggers.contains(trigger))
             {
                 d->triggers.append(trigger);
+                d->triggerGroups.insert(trigger, md->triggerGroup(trigger));
             }
         }
     
@@ -323,51 +336,197 @@ bool PackageList::process()
     d->ps->endProgress(d->downloadProgress);
     d->ps->endProgress(d->processProgress);
     
-    // Lancer les triggers
-    if (d->ps->runTriggers())
+    // Option QueueTriggers : ajouter les triggers laissés en attente par les
+    // transactions précédentes, chaque trigger n'est lancé qu'une fois
+    QString pendingFile = d->ps->varRoot() + "/var/cache/lgrpkg/db/pending_triggers";
+    bool queue = d->ps->queueTriggers();
+    
+    if (queue)
+    {
+        readPendingTriggers(pendingFile);
+    }
+    
+    if (!d->ps->runTriggers())
+    {
+        // Les garder pour la prochaine transaction si demandé
+        return (queue ? writePendingTriggers(pendingFile) : true);
+    }
+    
+    if (d->triggers.count() == 0)
+    {
+        return true;
+    }
+    
+    // Lancer les triggers. Ceux sans groupe forment une seule file et sont lancés
+    // l'un après l'autre, seuls les groupes déclarés par les paquets vont en parallèle
+    d->triggerProgress = d->ps->startProgress(Progress::Trigger, d->triggers.count());
+    d->tpl = new Templatable(this);
+    
+    // Remplir la template
+    d->tpl->addKey("instroot", d->ps->installRoot());
+    d->tpl->addKey("varroot", d->ps->varRoot());
+    d->tpl->addKey("confroot", d->ps->confRoot());
+    
+    QHash<QString, int> groupIndexes;
+    
+    d->triggerQueues.clear();
+    
+    foreach (const QString &trigger, d->triggers)
     {
-        int trigProgress = d->ps->startProgress(Progress::Trigger, d->triggers.count());
-        Templatable *tpl = new Templatable(this);
+        QString group = d->triggerGroups.value(trigger);
+        int index = groupIndexes.value(group, -1);
         
-        // Remplir la template
-        tpl->addKey("instroot", d->ps->installRoot());
-        tpl->addKey("varroot", d->ps->varRoot());
-        tpl->addKey("confroot", d->ps->confRoot());
+        if (index == -1)
+        {
+            index = d->triggerQueues.count();
+            groupIndexes.insert(group, index);
+            d->triggerQueues.append(QStringList());
+        }
         
-        for (int i=0; i<d->triggers.count(); ++i)
+        d->triggerQueues[index].append(trigger);
+    }
+    
+    d->runningGroups.clear();
+    d->runningTriggers = 0;
+    d->startedTriggers = 0;
+    d->triggerError = !startTriggers();
+    
+    if (d->runningTriggers != 0)
+    {
+        d->loop.exec();
+    }
+    
+    d->ps->endProgress(d->triggerProgress);
+    delete d->tpl;
+    d->tpl = 0;
+    
+    if (d->triggerError)
+    {
+        // Les triggers sont relancés en entier à la prochaine transaction
+        if (queue)
         {
-            const QString &trigger = d->triggers.at(i);
-            
-            // Progression
-            if (!d->ps->sendProgress(trigProgress, i, tpl->templateString(trigger), QString()))
-            {
-                d->ps->endProgress(trigProgress);
-                delete tpl;
-                return false;
-            }
-            
-            QProcess *proc = new QProcess;
-            
-            connect(proc, SIGNAL(finished(int, QProcess::ExitStatus)),
-                    this,   SLOT(triggerFinished(int, QProcess::ExitStatus)));
-                    
-            connect(proc, SIGNAL(readyReadStandardOutput()),
-                    this,   SLOT(triggerOut()));
-                    
-            proc->setProcessChannelMode(QProcess::MergedChannels);
+            writePendingTriggers(pendingFile);
+        }
+        
+        return false;
+    }
+    
+    if (queue)
+    {
+        QFile::remove(pendingFile);
+    }
+    
+    return true;
+}
+
+bool PackageList::startTriggers()
+{
+    // Au plus un trigger par groupe, et pas plus de triggers que de processeurs
+    int maxTriggers = qMax(1, QThread::idealThreadCount());
+    
+    for (int i=0; i<d->triggerQueues.count() && d->runningTriggers < maxTriggers; ++i)
+    {
+        QStringList &queue = d->triggerQueues[i];
+        
+        if (queue.isEmpty() || d->runningGroups.contains(i))
+        {
+            continue;
+        }
+        
+        QString trigger = d->tpl->templateString(queue.takeFirst());
+        
+        // Progression
+        if (!d->ps->sendProgress(d->triggerProgress, d->startedTriggers, trigger, QString()))
+        {
+            return false;
+        }
+        
+        QProcess *proc = new QProcess;
+        
+        connect(proc, SIGNAL(finished(int, QProcess::ExitStatus)),
+                this,   SLOT(triggerFinished(int, QProcess::ExitStatus)));
+                
+        connect(proc, SIGNAL(readyReadStandardOutput()),
+                this,   SLOT(triggerOut()));
+                
+        proc->setProcessChannelMode(QProcess::MergedChannels);
+        
+        // Exécuter le processus
+        proc->setProperty("lgr_trigger", trigger);  // Qt <3
+        proc->setProperty("lgr_group", i);
+        QString exec = d->ps->installRoot() + "/usr/bin/lgrpkg/triggers.postinst/" + trigger;
+        proc->start(exec, QIODevice::ReadOnly);
+        
+        if (!proc->waitForStarted())
+        {
+            // finished() ne sera pas émis
+            delete proc;
             
-            // Exécuter le processus
-            proc->setProperty("lgr_trigger", tpl->templateString(trigger));  // Qt <3
-            QString exec = d->ps->installRoot() + "/usr/bin/lgrpkg/triggers.postinst/" + tpl->templateString(trigger);
-            proc->start(exec, QIODevice::ReadOnly);
+            PackageError *err = new PackageError;
+            err->type = PackageError::ProcessError;
+            err->info = trigger;
             
-            rs = d->loop.exec();
+            d->ps->setLastError(err);
             
-            if (rs != 0) return false;
+            return false;
+        }
+        
+        d->runningGroups.insert(i);
+        d->runningTriggers++;
+        d->startedTriggers++;
+    }
+    
+    return true;
+}
+
+void PackageList::readPendingTriggers(const QString &fileName)
+{
+    QFile fl(fileName);
+    
+    if (!fl.open(QIODevice::ReadOnly))
+    {
+        return;
+    }
+    
+    // Une ligne par trigger : nom, tabulation, groupe
+    while (!fl.atEnd())
+    {
+        QList<QByteArray> parts = fl.readLine().trimmed().split('\t');
+        QString trigger = QString::fromUtf8(parts.at(0));
+        
+        if (trigger.isEmpty() || d->triggers.contains(trigger))
+        {
+            continue;
         }
         
-        delete tpl;
-        d->ps->endProgress(trigProgress);
+        d->triggers.append(trigger);
+        d->triggerGroups.insert(trigger, (parts.count() > 1 ? QString::fromUtf8(parts.at(1)) : QString()));
+    }
+}
+
+bool PackageList::writePendingTriggers(const QString &fileName)
+{
+    if (d->triggers.count() == 0)
+    {
+        return true;
+    }
+    
+    QFile fl(fileName);
+    
+    if (!fl.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        PackageError *err = new PackageError;
+        err->type = PackageError::OpenFileError;
+        err->info = fileName;
+        
+        d->ps->setLastError(err);
+        
+        return false;
+    }
+    
+    foreach (const QString &trigger, d->triggers)
+    {
+        fl.write(trigger.toUtf8() + '\t' + d->triggerGroups.value(trigger).toUtf8() + '\n');
     }
     
     return true;
@@ -378,14 +537,17 @@ void PackageList::triggerFinished(int exitCode, QProcess::ExitStatus exitStatus)
     // Plus besoin du processus
     QProcess *sh = static_cast<QProcess *>(sender());
     
-    if (sh != 0)
+    if (sh == 0)
     {
-        sh->deleteLater();
+        return;
     }
     
-    // Savoir si tout est ok
-    int rs = 0;
+    sh->deleteLater();
+    
+    d->runningGroups.remove(sh->property("lgr_group").toInt());
+    d->runningTriggers--;
     
+    // Savoir si tout est ok
     if (exitCode != 0 || exitStatus != QProcess::NormalExit)
     {
         PackageError *err = new PackageError;
@@ -394,11 +556,19 @@ void PackageList::triggerFinished(int exitCode, QProcess::ExitStatus exitStatus)
         
         d->ps->setLastError(err);
         
-        rs = 1;
+        d->triggerError = true;
+    }
+    
+    // Lancer les suivants, sauf en cas d'erreur où on attend juste ceux qui tournent
+    if (!d->triggerError && !startTriggers())
+    {
+        d->triggerError = true;
     }
     
-    // Quitter la boucle
-    d->loop.exit(rs);
+    if (d->runningTriggers == 0)
+    {
+        d->loop.exit(d->triggerError ? 1 : 0);
+    }
 }
 
 void PackageList::triggerOut()
@@ -169,6 +169,10 @@ class PackageList : public QObject, public QVector<Package *>
         void triggerOut();
         
     private:
+        bool startTriggers();
+        void readPendingTriggers(const QString &fileName);
+        bool writePendingTriggers(const QString &fileName);
+        
         struct Private;
         Private *d;
 };
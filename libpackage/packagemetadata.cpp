@@ -35,12 +35,31 @@
 #include <QRegExp>
 #include <QCryptographicHash>
 #include <QTemporaryFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDir>
+#include <QXmlStreamReader>
 
 #include <QtXml>
 #include <QtDebug>
 
 using namespace Logram;
 
+struct IndexedScript
+{
+    QString type, header, footer;
+    QByteArray text;
+};
+
+struct IndexedPackage
+{
+    QString tagName, name;
+    QStringList triggers, triggerGroups, primaryFlags;
+    QList<IndexedScript> scripts;
+};
+
 struct PackageMetaData::Private
 {
     PackageSystem *ps;
@@ -48,15 +67,123 @@ struct PackageMetaData::Private
     Package *pkg;
     
     QDomElement currentPackage;
+    QString currentName;
     
     bool error;
     
+    // Document construit seulement si nécessaire, voir ensureParsed()
+    QByteArray data;
+    bool parsed;
+    QString primaryLang;
+    QList<IndexedPackage> packages;     // <source> et <package>, dans l'ordre
+    
+    void index();
+    
     // Processus
     QEventLoop loop;
     QString commandLine;
     QByteArray buffer;
 };
 
+// Prélude scriptapi, lu une seule fois pour tous les scripts
+#define SCRIPTAPI_FILENAME "/usr/bin/lgrpkg/scriptapi"
+
+static QMutex scriptApiMutex;
+static QByteArray scriptApi;
+static QDateTime scriptApiModified;
+
+static bool scriptApiPrelude(QByteArray &rs)
+{
+    QMutexLocker locker(&scriptApiMutex);
+    QFileInfo fi(SCRIPTAPI_FILENAME);
+    
+    if (scriptApi.isNull() || fi.lastModified() != scriptApiModified)
+    {
+        QFile fl(SCRIPTAPI_FILENAME);
+        
+        if (!fl.open(QIODevice::ReadOnly))
+        {
+            return false;
+        }
+        
+        scriptApi = fl.readAll();
+        scriptApiModified = fi.lastModified();
+    }
+    
+    rs = scriptApi;
+    return true;
+}
+
+void PackageMetaData::Private::index()
+{
+    // Une seule passe sur le XML, en ne gardant que ce qui sert à l'installation
+    QXmlStreamReader xml(data);
+    int depth = 0;
+    
+    packages.clear();
+    primaryLang.clear();
+    
+    while (!xml.atEnd())
+    {
+        xml.readNext();
+        
+        if (xml.isEndElement())
+        {
+            --depth;
+            continue;
+        }
+        else if (!xml.isStartElement())
+        {
+            continue;
+        }
+        
+        ++depth;
+        
+        QXmlStreamAttributes attrs = xml.attributes();
+        
+        if (depth == 1)
+        {
+            primaryLang = attrs.value("primarylang").toString();
+        }
+        else if (depth == 2)
+        {
+            IndexedPackage pkg;
+            
+            pkg.tagName = xml.name().toString();
+            pkg.name = attrs.value("name").toString();
+            
+            packages.append(pkg);
+        }
+        else if (depth == 3)
+        {
+            IndexedPackage &pkg = packages.last();
+            
+            if (xml.name() == "trigger")
+            {
+                pkg.triggerGroups.append(attrs.value("group").toString());
+                pkg.triggers.append(xml.readElementText());
+                --depth;    // readElementText() lit l'élément de fin
+            }
+            else if (xml.name() == "script")
+            {
+                IndexedScript script;
+                
+                script.type = attrs.value("type").toString();
+                script.header = (attrs.hasAttribute("header") ? attrs.value("header").toString() : QString("header"));
+                script.footer = (attrs.hasAttribute("footer") ? attrs.value("footer").toString() : QString("footer"));
+                script.text = xml.readElementText().toUtf8();
+                
+                pkg.scripts.append(script);
+                --depth;
+            }
+            else if (xml.name() == "flag" && attrs.value("name") == "primary")
+            {
+                pkg.primaryFlags.append(attrs.hasAttribute("value") ? attrs.value("value").toString() : QString("1"));
+            }
+        }
+    }
+}
+
 PackageMetaData::PackageMetaData(PackageSystem *ps)
     : QObject(ps), QDomDocument()
 {
@@ -65,6 +192,7 @@ PackageMetaData::PackageMetaData(PackageSystem *ps)
     d->ps = ps;
     d->tpl = 0;
     d->pkg = 0;
+    d->parsed = true;   // Document vide
 }
 
 PackageMetaData::PackageMetaData(PackageSystem *ps, QObject *parent)
@@ -75,6 +203,7 @@ PackageMetaData::PackageMetaData(PackageSystem *ps, QObject *parent)
     d->ps = ps;
     d->tpl = 0;
     d->pkg = 0;
+    d->parsed = true;   // Document vide
 }
 
 void PackageMetaData::setTemplatable(Templatable *tpl)
@@ -160,11 +289,38 @@ void PackageMetaData::loadFile(const QString &fileName, const QByteArray &sha1ha
 
 void PackageMetaData::loadData(const QByteArray &data)
 {
-    setContent(data);
+    // Seulement indexer le document, il sera construit au premier besoin
+    d->data = data;
+    d->parsed = false;
+    d->currentName.clear();
+    d->currentPackage = QDomElement();
+    d->index();
     
     d->error = false;
 }
 
+void PackageMetaData::ensureParsed() const
+{
+    if (d->parsed)
+    {
+        return;
+    }
+    
+    const_cast<PackageMetaData *>(this)->setContent(d->data);
+    
+    // Le QDomDocument fait maintenant foi, il peut être modifié
+    d->parsed = true;
+    d->data.clear();
+    d->packages.clear();
+}
+
+QDomElement PackageMetaData::rootElement() const
+{
+    ensureParsed();
+    
+    return documentElement();
+}
+
 void PackageMetaData::bindPackage(Package *pkg)
 {
     QString fname = d->ps->varRoot() + "/var/cache/lgrpkg/db/pkgs/" + pkg->name() + "~" + pkg->version() + ".xml";
@@ -226,18 +382,62 @@ bool PackageMetaData::error() const
 
 QString PackageMetaData::primaryLang() const
 {
-    return documentElement().attribute("primarylang");
+    if (!d->parsed)
+    {
+        return d->primaryLang;
+    }
+    
+    return rootElement().attribute("primarylang");
 }
 
 QString PackageMetaData::upstreamUrl() const
 {
-    return documentElement().firstChildElement("source").attribute("upstreamurl");
+    return rootElement().firstChildElement("source").attribute("upstreamurl");
 }
 
 QStringList PackageMetaData::primaryPackages() const
 {
     QStringList rs;
-    QDomElement package = documentElement().firstChildElement("package");
+    
+    if (!d->parsed)
+    {
+        bool firstPackageCanBePrimary = true;
+        bool first = true;
+        QString firstPackage;
+        
+        foreach (const IndexedPackage &package, d->packages)
+        {
+            if (package.tagName != "package") continue;
+            
+            if (first)
+            {
+                firstPackage = package.name;
+            }
+            
+            foreach (const QString &value, package.primaryFlags)
+            {
+                if (value == "1")
+                {
+                    rs.append(package.name);
+                }
+                else if (first)
+                {
+                    firstPackageCanBePrimary = false;
+                }
+            }
+            
+            first = false;
+        }
+        
+        if (rs.count() == 0 && firstPackageCanBePrimary)
+        {
+            rs.append(firstPackage);
+        }
+        
+        return rs;
+    }
+    
+    QDomElement package = rootElement().firstChildElement("package");
     bool firstPackageCanBePrimary = true;
     bool first = true;
     
@@ -273,7 +473,7 @@ QStringList PackageMetaData::primaryPackages() const
     // Aucun paquet n'a ce flag, retourner le premier (il est très courant de mettre le paquet principal en premier)
     if (rs.count() == 0 && firstPackageCanBePrimary)
     {
-        package = documentElement().firstChildElement("package");
+        package = rootElement().firstChildElement("package");
         rs.append(package.attribute("name"));
     }
     
@@ -284,8 +484,21 @@ QStringList PackageMetaData::triggers() const
 {
     QStringList rs;
     
+    if (!d->parsed)
+    {
+        foreach (const IndexedPackage &package, d->packages)
+        {
+            if (package.tagName == "package" && package.name == d->currentName)
+            {
+                return package.triggers;
+            }
+        }
+        
+        return rs;
+    }
+    
     // Explorer les tags <trigger> du paquet courant
-    QDomElement trigger = d->currentPackage.firstChildElement("trigger");
+    QDomElement trigger = currentPackageElement().firstChildElement("trigger");
     
     while (!trigger.isNull())
     {
@@ -297,6 +510,46 @@ QStringList PackageMetaData::triggers() const
     return rs;
 }
 
+QString PackageMetaData::triggerGroup(const QString &trigger) const
+{
+    QString group;
+    
+    if (!d->parsed)
+    {
+        foreach (const IndexedPackage &package, d->packages)
+        {
+            if (package.tagName == "package" && package.name == d->currentName)
+            {
+                int index = package.triggers.indexOf(trigger);
+                
+                if (index != -1)
+                {
+                    group = package.triggerGroups.at(index);
+                }
+                
+                break;
+            }
+        }
+    }
+    else
+    {
+        QDomElement el = currentPackageElement().firstChildElement("trigger");
+        
+        while (!el.isNull())
+        {
+            if (el.text() == trigger)
+            {
+                group = el.attribute("group");
+                break;
+            }
+            
+            el = el.nextSiblingElement("trigger");
+        }
+    }
+    
+    return group;
+}
+
 QString PackageMetaData::stringOfKey(const QDomElement &element) const
 {
     return stringOfKey(element, primaryLang());
@@ -334,27 +587,27 @@ QString PackageMetaData::stringOfKey(const QDomElement &element, const QString &
 
 QString PackageMetaData::packageDescription() const
 {
-    return stringOfKey(d->currentPackage.firstChildElement("description"));
+    return stringOfKey(currentPackageElement().firstChildElement("description"));
 }
 
 QString PackageMetaData::packageTitle() const
 {
-    return stringOfKey(d->currentPackage.firstChildElement("title"));
+    return stringOfKey(currentPackageElement().firstChildElement("title"));
 }
 
 QString PackageMetaData::packageEula() const
 {
-    return stringOfKey(d->currentPackage.firstChildElement("eula"));
+    return stringOfKey(currentPackageElement().firstChildElement("eula"));
 }
 
 QString PackageMetaData::packageExecutable() const
 {
-    return d->currentPackage.firstChildElement("executable").attribute("path");
+    return currentPackageElement().firstChildElement("executable").attribute("path");
 }
 
 QByteArray PackageMetaData::packageIconData() const
 {
-    QDomElement iconElement = d->currentPackage.firstChildElement("icon");
+    QDomElement iconElement = currentPackageElement().firstChildElement("icon");
     
     if (iconElement.isNull())
     {
@@ -388,12 +641,12 @@ QByteArray PackageMetaData::packageIconData() const
 
 QString PackageMetaData::packageIconOrigFileName() const
 {
-    return d->currentPackage.firstChildElement("icon").attribute("file");
+    return currentPackageElement().firstChildElement("icon").attribute("file");
 }
 
 PackageMetaData::IconType PackageMetaData::packageIconType() const
 {
-    QDomElement iconElement = d->currentPackage.firstChildElement("icon");
+    QDomElement iconElement = currentPackageElement().firstChildElement("icon");
     
     if (iconElement.isNull())
     {
@@ -412,18 +665,35 @@ PackageMetaData::IconType PackageMetaData::packageIconType() const
 
 QString PackageMetaData::currentPackage() const
 {
-    return d->currentPackage.attribute("name");
+    return d->currentName;
 }
        
 void PackageMetaData::setCurrentPackage(const QString &name)
 {
+    if (!d->parsed)
+    {
+        // L'élément ne sera trouvé que si on en a besoin
+        foreach (const IndexedPackage &package, d->packages)
+        {
+            if (package.tagName == "package" && package.name == name)
+            {
+                d->currentName = name;
+                d->currentPackage = QDomElement();
+                return;
+            }
+        }
+        
+        return;
+    }
+    
     // Explorer les paquets à la recherche de celui qu'on cherche
-    QDomElement package = documentElement().firstChildElement("package");
+    QDomElement package = rootElement().firstChildElement("package");
     
     while (!package.isNull())
     {
         if (package.attribute("name") == name)
         {
+            d->currentName = name;
             d->currentPackage = package;
             return;
         }
@@ -434,12 +704,28 @@ void PackageMetaData::setCurrentPackage(const QString &name)
 
 QDomElement PackageMetaData::currentPackageElement() const
 {
+    if (d->currentPackage.isNull() && !d->currentName.isNull())
+    {
+        QDomElement package = rootElement().firstChildElement("package");
+        
+        while (!package.isNull())
+        {
+            if (package.attribute("name") == d->currentName)
+            {
+                d->currentPackage = package;
+                break;
+            }
+            
+            package = package.nextSiblingElement("package");
+        }
+    }
+    
     return d->currentPackage;
 }
 
 QVector<ChangeLogEntry *> PackageMetaData::changelog() const
 {
-    QDomElement entry = documentElement().firstChildElement("changelog").firstChildElement("entry");
+    QDomElement entry = rootElement().firstChildElement("changelog").firstChildElement("entry");
     
     QVector<ChangeLogEntry *> rs;
     
@@ -456,7 +742,7 @@ QVector<ChangeLogEntry *> PackageMetaData::changelog() const
         // Si le paquet est un paquet de développement, utiliser la vraie version
         QString realver = entry.attribute("realversion");
         
-        if (!realver.isNull() && documentElement().firstChildElement("source").attribute("devel", "false") == "true")
+        if (!realver.isNull() && rootElement().firstChildElement("source").attribute("devel", "false") == "true")
         {
             e->version = realver;
         }
@@ -500,7 +786,7 @@ QVector<SourceDepend *> PackageMetaData::sourceDepends() const
     SourceDepend *dep;
     QString deptype;
     
-    QDomElement depend = documentElement().firstChildElement("source").firstChildElement("depend");
+    QDomElement depend = rootElement().firstChildElement("source").firstChildElement("depend");
     
     while (!depend.isNull())
     {
@@ -545,7 +831,50 @@ QByteArray PackageMetaData::scriptOut() const
 
 QByteArray PackageMetaData::script(const QString &key, const QString &type)
 {
-    QDomElement package = documentElement().firstChildElement();
+    if (!d->parsed)
+    {
+        foreach (const IndexedPackage &package, d->packages)
+        {
+            if ((package.tagName == "source" && key == "source") ||
+                (package.tagName == "package" && package.name == key))
+            {
+                int index = -1;
+                QByteArray h, f;
+                
+                for (int i=0; i<package.scripts.count(); ++i)
+                {
+                    if (package.scripts.at(i).type == type)
+                    {
+                        index = i;
+                        break;
+                    }
+                }
+                
+                // Un script vide n'est pas lancé, même s'il a un en-tête
+                if (index == -1 || package.scripts.at(index).text.trimmed().isEmpty()) break;
+                
+                const IndexedScript &script = package.scripts.at(index);
+                
+                foreach (const IndexedScript &other, package.scripts)
+                {
+                    if (other.type == script.header)
+                    {
+                        h = other.text;
+                    }
+                    else if (other.type == script.footer)
+                    {
+                        f = other.text;
+                    }
+                }
+                
+                return h + '\n' + script.text + '\n' + f;
+            }
+        }
+        
+        return QByteArray();
+    }
+    
+    QDomElement package = rootElement().firstChildElement();
     
     while (!package.isNull())
     {
@@ -574,7 +903,7 @@ QByteArray PackageMetaData::script(const QString &key, const QString &type)
                 script = script.nextSiblingElement("script");
             }
             
-            if (!found) break;
+            if (!found || rs.trimmed().isEmpty()) break;
             
             // Trouver son en-tête ou pied si nécessaire
             script = package.firstChildElement("script");
@@ -611,22 +940,20 @@ bool PackageMetaData::runScript(const QByteArray &script, const QStringList &arg
     }
     
     // Charger le script
-    QFile scriptapi("/usr/bin/lgrpkg/scriptapi");
+    QByteArray header;
     
-    if (!scriptapi.open(QIODevice::ReadOnly))
+    if (!scriptApiPrelude(header))
     {
         PackageError *err = new PackageError;
         err->type = PackageError::OpenFileError;
-        err->info = scriptapi.fileName();
+        err->info = SCRIPTAPI_FILENAME;
         
         d->ps->setLastError(err);
         
         return false;
     }
     
-    QByteArray header = scriptapi.readAll();
     header += script;
-    scriptapi.close();
     
     // Écrire le fichier de script complet dans un QTemporaryFile
     QTemporaryFile tfl;
@@ -774,4 +1101,4 @@ void PackageMetaData::processTerminated(int exitCode, QProcess::ExitStatus exitS
     d->loop.exit(rs);
 }
 
-#include "packagemetadata.moc"
\ No newline at end of file
+#include "packagemetadata.moc"
@@ -90,6 +90,14 @@ struct SourceDepend
  * Comme cette classe hérite de QDomDocument, il est possible pour
  * l'application d'effectuer toutes les opérations qu'elle veut sur le
  * document. C'est le côté extensible de cette classe.
+ * 
+ * Le QDomDocument n'est construit que par ensureParsed(), appelée par les
+ * fonctions de cette classe qui en ont besoin. Avant cela, primaryLang(),
+ * primaryPackages(), triggers(), setCurrentPackage() et script() utilisent
+ * un index construit en une seule passe par loadData(), ce qui évite de
+ * charger les icônes et l'historique lors d'une installation. Appelez donc
+ * ensureParsed() après loadFile() ou loadData() avant d'utiliser
+ * directement une fonction de QDomDocument.
  */
 class PackageMetaData : public QObject, public QDomDocument
 {
@@ -234,6 +242,19 @@ class PackageMetaData : public QObject, public QDomDocument
         QString upstreamUrl() const;            /*!< @brief Url du site web de l'auteur du paquet source (gcc.gnu.org, etc) */
         QStringList triggers() const;           /*!< @brief Liste des triggers lancés par le paquet courant */
         
+        /**
+         * @brief Groupe d'un trigger du paquet courant
+         * 
+         * Les triggers d'un même groupe (attribut @b group de \<trigger /\>)
+         * sont lancés l'un après l'autre, ceux de groupes différents en
+         * parallèle (voir PackageList::process()). Les triggers sans groupe
+         * sont lancés l'un après l'autre.
+         * 
+         * @param trigger Nom du trigger, tel que renvoyé par triggers()
+         * @return Groupe du trigger, ou une chaîne vide s'il n'en a pas
+         */
+        QString triggerGroup(const QString &trigger) const;
+        
         QVector<ChangeLogEntry *> changelog() const;   /*!< @brief Historique du paquet source */
         QVector<SourceDepend *> sourceDepends() const; /*!< @brief Dépendances à la construction du paquet source */
         
@@ -278,6 +299,16 @@ class PackageMetaData : public QObject, public QDomDocument
         void setCurrentPackage(const QString &name);
         QDomElement currentPackageElement() const;  /*!< @brief QDomElement du paquet courant (\<package name="..." /\>) */
         
+        /**
+         * @brief Construit le QDomDocument
+         * 
+         * loadFile() et loadData() ne font qu'indexer les métadonnées. Cette
+         * fonction construit le document s'il ne l'a pas encore été, et doit
+         * être appelée avant toute fonction de QDomDocument (documentElement(),
+         * createElement(), toByteArray(), etc).
+         */
+        void ensureParsed() const;
+        
         /**
          * @brief Obtient une chaîne traduite
          * 
@@ -324,7 +355,7 @@ class PackageMetaData : public QObject, public QDomDocument
          * 
          * @param key Clef à utiliser (source pour les scripts de la source, ou le nom d'un paquet binaire)
          * @param type Valeur que doit avoir l'attribut @b type du \<script /\> pour qu'il soit pris 
-         * @return Script sous forme brute (passable à Bash). QByteArray vide si le script n'existe pas.
+         * @return Script sous forme brute (passable à Bash). QByteArray vide si le script n'existe pas ou ne contient que des espaces.
          */
         QByteArray script(const QString &key, const QString &type);
         
@@ -382,6 +413,8 @@ class PackageMetaData : public QObject, public QDomDocument
         void processLineOut(QProcess *process, const QByteArray &line);
         
     private:
+        QDomElement rootElement() const;
+        
         struct Private;
         Private *d;
 };
@@ -33,10 +33,15 @@
 #include <QVector>
 #include <QDirIterator>
 #include <QPluginLoader>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QtConcurrentMap>
 
 #include <archive.h>
 #include <archive_entry.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <sys/stat.h>
 
 #include <QtXml>
@@ -56,30 +61,143 @@ struct PackageSource::Private
     QVector<PackageRemark *> remarks;
 };
 
-void PackageSource::listFiles(const QString &dir, const QString &prefix, QStringList &list)
+struct ListEntry
+{
+    QString name;
+    QString sortName;   // Nom en minuscules, pour trier comme QDir::Name | QDir::IgnoreCase
+    bool isDir;
+};
+
+static bool entryLessThan(const ListEntry &a, const ListEntry &b)
+{
+    return a.sortName < b.sortName;
+}
+
+static QList<ListEntry> readDirectory(const QString &dir)
 {
-    QDir mdir(dir);
-    QFileInfoList files = mdir.entryInfoList(QDir::Dirs | QDir::Files | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+    // readdir() donne le type de la plupart des entrées sans stat(). Seuls les
+    // fichiers et les dossiers (liens symboliques suivis) sont retenus
+    QList<ListEntry> rs;
+    QByteArray path = QFile::encodeName(dir);
+    DIR *d = opendir(path.constData());
+    struct dirent *ent;
+    
+    if (d == 0)
+    {
+        return rs;
+    }
     
-    foreach(const QFileInfo &fi, files)
+    while ((ent = readdir(d)) != 0)
     {
-        // Si c'est un fichier, l'ajouter à la liste
-        if (fi.isFile())
+        const char *name = ent->d_name;
+        ListEntry entry;
+        
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
         {
-            list.append(prefix + fi.fileName());
+            continue;
         }
-        else if (fi.isDir())
+        
+        if (ent->d_type == DT_REG)
         {
-            // L'explorer
-            int oldcount = list.count();
+            entry.isDir = false;
+        }
+        else if (ent->d_type == DT_DIR)
+        {
+            entry.isDir = true;
+        }
+        else
+        {
+            struct stat st;
             
-            listFiles(fi.absoluteFilePath(), prefix + fi.fileName() + '/', list);
+            if (stat((path + '/' + name).constData(), &st) != 0)
+            {
+                continue;
+            }
+            
+            if (S_ISREG(st.st_mode))
+            {
+                entry.isDir = false;
+            }
+            else if (S_ISDIR(st.st_mode))
+            {
+                entry.isDir = true;
+            }
+            else
+            {
+                continue;
+            }
+        }
+        
+        entry.name = QFile::decodeName(name);
+        entry.sortName = entry.name.toLower();
+        rs.append(entry);
+    }
+    
+    closedir(d);
+    
+    qSort(rs.begin(), rs.end(), entryLessThan);
+    
+    return rs;
+}
+
+struct ListFrame
+{
+    QString dir;
+    QString prefix;
+    QList<ListEntry> entries;
+    int pos;
+    int oldcount;   // Taille de la liste à l'entrée dans le dossier, -1 pour la racine
+};
 
+void PackageSource::listFiles(const QString &dir, const QString &prefix, QStringList &list)
+{
+    // Parcours en profondeur avec une pile plutôt que par récursion
+    QVector<ListFrame> stack;
+    ListFrame root;
+    
+    root.dir = dir;
+    root.prefix = prefix;
+    root.entries = readDirectory(dir);
+    root.pos = 0;
+    root.oldcount = -1;
+    
+    stack.append(root);
+    
+    while (!stack.isEmpty())
+    {
+        ListFrame &frame = stack.last();
+        
+        if (frame.pos == frame.entries.count())
+        {
             // Si on n'a pas ajouté d'entrées, alors le dossier est vide et il faut le gérer
-            if (oldcount == list.count())
+            if (frame.oldcount == list.count())
             {
-                list.append(prefix + fi.fileName());
+                list.append(frame.prefix.left(frame.prefix.length() - 1));
             }
+            
+            stack.remove(stack.count() - 1);
+            continue;
+        }
+        
+        const ListEntry &entry = frame.entries.at(frame.pos++);
+        
+        if (!entry.isDir)
+        {
+            // Si c'est un fichier, l'ajouter à la liste
+            list.append(frame.prefix + entry.name);
+        }
+        else
+        {
+            // L'explorer. frame n'est plus valide après l'ajout à la pile
+            ListFrame child;
+            
+            child.dir = frame.dir + '/' + entry.name;
+            child.prefix = frame.prefix + entry.name + '/';
+            child.entries = readDirectory(child.dir);
+            child.pos = 0;
+            child.oldcount = list.count();
+            
+            stack.append(child);
         }
     }
 }
@@ -141,6 +259,7 @@ bool PackageSource::setMetaData(const QString &fileName)
     d->md = new PackageMetaData(d->ps);
     
     d->md->loadFile(fileName, QByteArray(), false);
+    d->md->ensureParsed();  // La source et ses plugins modifient le document
     d->md->setTemplatable(this);
     
     return !d->md->error();
@@ -151,6 +270,7 @@ bool PackageSource::setMetaData(const QByteArray &data)
     d->md = new PackageMetaData(d->ps);
     
     d->md->loadData(data);
+    d->md->ensureParsed();
 
     return !d->md->error();
 }
@@ -230,12 +350,209 @@ bool PackageSource::build()
     return true;
 }
 
+/*
+ * Motif <files pattern="" /> compilé. Les motifs les plus courants (un chemin
+ * exact, un préfixe suivi de *, * suivi d'un suffixe) sont testés sans QRegExp
+ */
+struct FilePattern
+{
+    enum Kind
+    {
+        All,
+        Exact,
+        Prefix,
+        Suffix,
+        Wildcard
+    };
+    
+    FilePattern(const QString &pattern, bool _exclude) : exclude(_exclude)
+    {
+        int stars = pattern.count('*');
+        bool special = pattern.contains('?') || pattern.contains('[') || pattern.contains('\\');
+        
+        if (pattern == "*")
+        {
+            kind = All;
+        }
+        else if (special || stars > 1)
+        {
+            kind = Wildcard;
+            regex = QRegExp(pattern, Qt::CaseSensitive, QRegExp::Wildcard);
+        }
+        else if (stars == 0)
+        {
+            kind = Exact;
+            text = pattern;
+        }
+        else if (pattern.endsWith('*'))
+        {
+            kind = Prefix;
+            text = pattern.left(pattern.length() - 1);
+        }
+        else if (pattern.startsWith('*'))
+        {
+            kind = Suffix;
+            text = pattern.mid(1);
+        }
+        else
+        {
+            kind = Wildcard;
+            regex = QRegExp(pattern, Qt::CaseSensitive, QRegExp::Wildcard);
+        }
+    }
+    
+    bool matches(const QString &fname) const
+    {
+        switch (kind)
+        {
+            case All:
+                return true;
+            case Exact:
+                return fname == text;
+            case Prefix:
+                return fname.startsWith(text);
+            case Suffix:
+                return fname.endsWith(text);
+            default:
+                return regex.exactMatch(fname);
+        }
+    }
+    
+    Kind kind;
+    QString text;
+    QRegExp regex;
+    bool exclude;
+};
+
 struct _PackageFile
 {
     QString from;
     QString to;
 };
 
+/*
+ * Archive .lpk à créer par binaries(). Les archives sont indépendantes, elles
+ * sont compressées en parallèle par ArchiveWriter
+ */
+struct ArchiveJob
+{
+    int index;                  // Position dans la liste des archives à créer
+    QString packageFile;
+    QVector<_PackageFile> files;
+};
+
+struct ArchiveState
+{
+    QMutex mutex;
+    QWaitCondition cond;
+    QList<int> finished;        // Index des archives terminées, pas encore signalées
+};
+
+// Crée l'archive .lpk (tar + xz) (code largement inspiré de l'exemple de "man archive_write").
+// Si ps est non-nul, la progression fichier par fichier est envoyée (uniquement depuis le thread principal)
+static bool writeArchive(const ArchiveJob &job, PackageSystem *ps, bool xzThreads)
+{
+    struct archive *a;
+    struct archive *disk;
+    struct archive_entry *entry;
+    char *buff = new char[8192];
+    int len;
+    int fd;
+    int mp = -1;
+    
+    a = archive_write_new();
+    archive_write_set_compression_xz(a);
+    
+#if ARCHIVE_VERSION_NUMBER >= 3003000
+    if (xzThreads)
+    {
+        // Une seule archive à créer, xz peut utiliser tous les processeurs
+        archive_write_set_filter_option(a, "xz", "threads", "0");
+    }
+#else
+    (void) xzThreads;
+#endif
+    
+    archive_write_set_format_ustar(a);
+    archive_write_open_filename(a, qPrintable(job.packageFile));
+    
+    disk = archive_read_disk_new();
+    archive_read_disk_set_standard_lookup(disk);
+    
+    if (ps)
+    {
+        mp = ps->startProgress(Progress::Compressing, job.files.count());
+    }
+    
+    for (int i=0; i<job.files.count(); ++i)
+    {
+        const _PackageFile &pf = job.files.at(i);
+        
+        if (ps && !ps->sendProgress(mp, i, pf.to))
+        {
+            archive_read_finish(disk);
+            archive_write_close(a);
+            archive_write_finish(a);
+            delete[] buff;
+            
+            return false;
+        }
+        
+        // Ajouter l'élément
+        fd = open(qPrintable(pf.from), O_RDONLY);
+        entry = archive_entry_new();
+        
+        struct stat st;
+        lstat(qPrintable(pf.from), &st);
+        
+        archive_entry_set_pathname(entry, qPrintable(pf.to));
+        archive_entry_copy_sourcepath(entry, qPrintable(pf.from));
+        archive_read_disk_entry_from_file(disk, entry, fd, &st);
+        
+        archive_write_header(a, entry);
+        len = read(fd, buff, 8192);
+        
+        while (len > 0)
+        {
+            archive_write_data(a, buff, len);
+            len = read(fd, buff, 8192);
+        }
+        
+        close(fd);
+        archive_entry_free(entry);
+    }
+    
+    if (ps)
+    {
+        ps->endProgress(mp);
+    }
+    
+    archive_read_finish(disk);
+    archive_write_close(a);
+    archive_write_finish(a);
+    delete[] buff;
+    
+    return true;
+}
+
+struct ArchiveWriter
+{
+    ArchiveWriter(ArchiveState *_state) : state(_state) {}
+    
+    void operator()(const ArchiveJob &job)
+    {
+        writeArchive(job, 0, false);
+        
+        // Prévenir le thread principal, qui envoie la progression
+        QMutexLocker locker(&state->mutex);
+        
+        state->finished.append(job.index);
+        state->cond.wakeAll();
+    }
+    
+    ArchiveState *state;
+};
+
 bool PackageSource::binaries()
 {   
     // Créer la liste des fichiers dans le dossier de construction
@@ -393,37 +710,34 @@ bool PackageSource::binaries()
         }
         else
         {
+            // Compiler les motifs, puis les tester une seule fois par fichier. Un
+            // motif d'exclusion retire les fichiers ajoutés par les motifs qui le
+            // précèdent : c'est donc le dernier motif correspondant qui décide
+            QList<FilePattern> patterns;
             QDomElement pattern = package.firstChildElement("files");
             
             while (!pattern.isNull())
             {
-                QRegExp regex(pattern.attribute("pattern", "*"), Qt::CaseSensitive, QRegExp::Wildcard);
-                bool exclude = (pattern.attribute("exclude", "false") == "true");
+                patterns.prepend(FilePattern(pattern.attribute("pattern", "*"),
+                                             pattern.attribute("exclude", "false") == "true"));
                 
-                if (!exclude)
+                pattern = pattern.nextSiblingElement("files");
+            }
+            
+            foreach (const QString &fname, files)
+            {
+                foreach (const FilePattern &p, patterns)
                 {
-                    foreach (const QString &fname, files)
+                    if (p.matches(fname))
                     {
-                        if (regex.exactMatch(fname))
+                        if (!p.exclude)
                         {
                             okFiles.append(fname);
                         }
+                        
+                        break;
                     }
                 }
-                else
-                {
-                    // Retirer d'okFiles les fichiers qui correspondent
-                    for (int i=0; i<okFiles.count(); ++i)
-                    {
-                        if (regex.exactMatch(okFiles.at(i)))
-                        {
-                            okFiles.removeAt(i);
-                            --i;
-                        }
-                    }
-                }
-                
-                pattern = pattern.nextSiblingElement("files");
             }
         }
         
@@ -499,6 +813,7 @@ bool PackageSource::binaries()
     int totPkg = d->md->documentElement().elementsByTagName("package").count() + 1; // Aussi la source
     
     int progress = d->ps->startProgress(Progress::GlobalCompressing, totPkg);
+    QVector<ArchiveJob> jobs;
     
     package = d->md->documentElement().firstChildElement();
     
@@ -545,16 +860,14 @@ bool PackageSource::binaries()
         // Obtenir le nom de fichier
         QString packageFile = packageName + "~" + version + "." + arch + ".lpk";
         
-        // Envoyer le signal de progression
-        if (!d->ps->sendProgress(progress, curPkg, packageFile))
-        {
-            return false;
-        }
-        
         curPkg++;
         
         // Créer la liste des _PackageFiles permettant de créer l'archive
-        QVector<_PackageFile> packageFiles;
+        jobs.append(ArchiveJob());
+        jobs.last().index = jobs.count() - 1;
+        jobs.last().packageFile = packageFile;
+        
+        QVector<_PackageFile> &packageFiles = jobs.last().files;
         _PackageFile pf;
         
         // D'abord, le fichier de métadonnées
@@ -604,64 +917,71 @@ bool PackageSource::binaries()
             packageFiles.append(pf);
         }
         
-        // Créer l'archive .lpk (tar + xz) (code largement inspiré de l'exemple de "man archive_write")
-        struct archive *a;
-        struct archive *disk;
-        struct archive_entry *entry;
-        char *buff = new char[8192];
-        int len;
-        int fd;
-        
-        a = archive_write_new();
-        archive_write_set_compression_xz(a);
-        archive_write_set_format_ustar(a);
-        archive_write_open_filename(a, qPrintable(packageFile));
+        package = package.nextSiblingElement();
+    }
+    
+    // Compresser les paquets. Chaque archive est créée par un thread du pool, le
+    // thread principal se charge d'envoyer la progression
+    if (jobs.count() > 1 && QThread::idealThreadCount() > 1)
+    {
+        ArchiveState state;
+        int sent = 0;
         
-        disk = archive_read_disk_new();
-        archive_read_disk_set_standard_lookup(disk);
+        QFuture<void> future = QtConcurrent::map(jobs, ArchiveWriter(&state));
         
-        int mp = d->ps->startProgress(Progress::Compressing, packageFiles.count());
+        state.mutex.lock();
         
-        for (int i=0; i<packageFiles.count(); ++i)
+        while (sent < jobs.count())
         {
-            const _PackageFile &pf = packageFiles.at(i);
-            
-            if (!d->ps->sendProgress(mp, i, pf.to))
+            if (state.finished.isEmpty())
             {
-                return false;
+                state.cond.wait(&state.mutex);
+                continue;
             }
             
-            // Ajouter l'élément
-            fd = open(qPrintable(pf.from), O_RDONLY);
-            entry = archive_entry_new();
+            // Les archives se terminent dans n'importe quel ordre, signaler celles qui le sont
+            QList<int> finished = state.finished;
             
-            struct stat st;
-            lstat(qPrintable(pf.from), &st);
+            state.finished.clear();
+            state.mutex.unlock();
             
-            archive_entry_set_pathname(entry, qPrintable(pf.to));
-            archive_entry_copy_sourcepath(entry, qPrintable(pf.from));
-            archive_read_disk_entry_from_file(disk, entry, fd, &st);
+            foreach (int index, finished)
+            {
+                if (!d->ps->sendProgress(progress, sent, jobs.at(index).packageFile))
+                {
+                    // Les archives déjà commencées sont terminées
+                    future.cancel();
+                    future.waitForFinished();
+                    
+                    return false;
+                }
+                
+                sent++;
+            }
             
-            archive_write_header(a, entry);
-            len = read(fd, buff, 8192);
+            state.mutex.lock();
+        }
+        
+        state.mutex.unlock();
+        future.waitForFinished();
+    }
+    else
+    {
+        for (int i=0; i<jobs.count(); ++i)
+        {
+            const ArchiveJob &job = jobs.at(i);
             
-            while (len > 0)
+            // Envoyer le signal de progression
+            if (!d->ps->sendProgress(progress, i, job.packageFile))
             {
-                archive_write_data(a, buff, len);
-                len = read(fd, buff, 8192);
+                return false;
             }
             
-            close(fd);
-            archive_entry_free(entry);
+            if (!writeArchive(job, d->ps, jobs.count() == 1))
+            {
+                return false;
+            }
         }
-        
-        d->ps->endProgress(mp);
-        
-        archive_write_close(a);
-        archive_write_finish(a);
-        delete[] buff;
-        
-        package = package.nextSiblingElement();
     }
     
     // Informer les plugins qu'on a fini
@@ -53,6 +53,7 @@
 #define PACKAGESYSTEM_OPT_INSTALLROOT        4
 #define PACKAGESYSTEM_OPT_CONFROOT           8
 #define PACKAGESYSTEM_OPT_VARROOT           16
+#define PACKAGESYSTEM_OPT_QUEUETRIGGERS     32
 
 using namespace Logram;
 using namespace std;
@@ -79,7 +80,7 @@ struct Logram::PackageSystem::Private
     // Options
     int parallelInstalls, parallelDownloads;
     QString installRoot, confRoot, varRoot;
-    bool triggers;
+    bool triggers, queueTriggers;
     int setParams;
     QStringList pluginPaths;
     
@@ -104,6 +105,7 @@ Logram::PackageSystem::PackageSystem(QObject *parent) : QObject(parent)
     d->ipackages = 0;
     d->firstFile = 0;
     d->triggers = true;
+    d->queueTriggers = false;
     
     d->processOutProgress = startProgress(Progress::ProcessOut, 1);
     
@@ -153,6 +155,10 @@ void Logram::PackageSystem::loadConfig()
     {
         d->varRoot = d->set->value("VarRoot", "/").toString();
     }
+    if ((d->setParams & PACKAGESYSTEM_OPT_QUEUETRIGGERS) == 0)
+    {
+        d->queueTriggers = d->set->value("QueueTriggers", false).toBool();
+    }
     
     d->pluginPaths << d->set->value("PluginPaths", "/usr/lib/lgrpkg").toString().split(':', QString::SkipEmptyParts);
     
@@ -1034,6 +1040,11 @@ bool Logram::PackageSystem::runTriggers() const
     return d->triggers;
 }
 
+bool Logram::PackageSystem::queueTriggers() const
+{
+    return d->queueTriggers;
+}
+
 void Logram::PackageSystem::setConfRoot(const QString &root)
 {
     d->setParams |= PACKAGESYSTEM_OPT_CONFROOT;
@@ -1074,6 +1085,13 @@ void Logram::PackageSystem::setRunTriggers(bool enable)
     d->triggers = enable;
 }
 
+void Logram::PackageSystem::setQueueTriggers(bool enable)
+{
+    d->setParams |= PACKAGESYSTEM_OPT_QUEUETRIGGERS;
+    
+    d->queueTriggers = enable;
+}
+
 void PackageSystem::addPluginPath(const QString& path)
 {
     d->pluginPaths.append(path);
@@ -353,7 +353,10 @@ class PackageSystem : public QObject
          * 
          * Renvoie la liste des fichiers dont le nom correspond à @p regex. Le chemin d'accès est ignoré.
          * 
-         * Cette fonction est un peu lente, de complexité O(n) où n est le nombre de fichiers en base de donnée.
+         * Cette fonction utilise l'index des noms de fichiers construit par update(). Un motif sensible à
+         * la casse commençant ou finissant par une partie littérale (<em>msg*</em>, <em>*.pc</em>) est
+         * résolu par recherche dichotomique, les autres testent une fois chaque nom de fichier différent.
+         * DatabaseReader::files() contient les détails.
          * 
          * @code
          * QVector<PackageFile *> files = ps->files(QRegExp("msg*", Qt::CaseSensitive, QRegExp::Wildcard));
@@ -531,12 +534,14 @@ class PackageSystem : public QObject
         QString varRoot() const;                    /*!< @brief Dossier racine pour la base de donnée (root/var/cache/...) */
         QStringList pluginPaths() const;            /*!< @brief Chemin d'accès aux plugins PackageSource */
         bool runTriggers() const;                   /*!< @brief True pour lancer les triggers */
+        bool queueTriggers() const;                 /*!< @brief True pour garder les triggers non lancés pour la prochaine transaction (option QueueTriggers) */
         void setParallelDownloads(int num);         /*!< @brief Nombre de téléchargements en parallèle */
         void setParallelInstalls(int num);          /*!< @brief Nombre d'installations en parallèle */
         void setInstallRoot(const QString &root);   /*!< @brief Dossier racine pour l'installation */
         void setConfRoot(const QString &root);      /*!< @brief Dossier racine pour la configuration */
         void setVarRoot(const QString &root);       /*!< @brief Dossier racine pour la base de donnée */
         void setRunTriggers(bool enable);           /*!< @brief True pour lancer les triggers */
+        void setQueueTriggers(bool enable);         /*!< @brief True pour garder les triggers non lancés pour la prochaine transaction */
         void addPluginPath(const QString &path);    /*!< @brief Ajoute un chemin de recherche pour les plugins */
         
         // Gestion des erreurs
@@ -54,9 +54,11 @@ void CheckFiles::init(PackageMetaData* md, PackageSource* src)
 
 void CheckFiles::end()
 {
-    // Tous les fichiers qui restent dans builtfiles sont orphelins
+    // Tous les fichiers de builtfiles qui ne sont pas dans packagedfiles sont orphelins
     foreach (const QString &file, builtfiles)
     {
+        if (packagedfiles.contains(file)) continue;
+        
         PackageRemark *remark = new PackageRemark;
             
         remark->severity = PackageRemark::Warning;
@@ -67,6 +69,7 @@ void CheckFiles::end()
     }
     
     builtfiles.clear();
+    packagedfiles.clear();
 }
 
 void CheckFiles::processPackage(const QString& name, QStringList& files, bool isSource)
@@ -78,19 +81,11 @@ void CheckFiles::processPackage(const QString& name, QStringList& files, bool is
     {
         const QString &file = files.at(i);
         
-        // Supprimer ce fichier de builtfiles
-        for (int j=0; j<builtfiles.count(); ++j)
-        {
-            const QString &bfile = builtfiles.at(j);
-            
-            if (bfile == file)
-            {
-                builtfiles.removeAt(j);
-                break;
-            }
-        }
+        // Ce fichier n'est plus orphelin. Un QSet évite de parcourir builtfiles
+        // pour chaque fichier, ce qui est très lent pour les gros paquets
+        packagedfiles.insert(file);
         
-        // Supprimer les fichiers en trop (NOTE: Après la population de builtfiles car les éventuels .removeAt invalident file.
+        // Supprimer les fichiers en trop (NOTE: Après l'insertion dans packagedfiles car le .removeAt invalide file.
         if (file == "/usr/share/info/dir")
         {
             PackageRemark *remark = new PackageRemark;
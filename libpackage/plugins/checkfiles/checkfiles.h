@@ -24,6 +24,7 @@
 #define __CHECKFILES_H__
 
 #include <QObject>
+#include <QSet>
 #include <QtPlugin>
 
 #include <packagesource.h>
@@ -48,6 +49,7 @@ class CheckFiles : public QObject, public PackageSourceInterface
     private:
         PackageSource *src;
         QStringList builtfiles;
+        QSet<QString> packagedfiles;
 };
 
 #endif
\ No newline at end of file
@@ -59,43 +59,29 @@ void FileManyPackages::processPackage(const QString& name, QStringList& files, b
     for (int i=0; i<files.count(); ++i)
     {
         const QString &file = files.at(i);
-        bool found = false;
         
         // Voir si ce fichier existe déjà.
-        for (int j=0; j<enrgs.count(); ++j)
+        QHash<QString, QString>::iterator it = enrgs.find(file);
+        
+        if (it != enrgs.end())
         {
-            Enrg &enrg = enrgs[j];
+            // Ah, ce fichier est déjà dedans.
+            PackageRemark *remark = new PackageRemark;
+        
+            remark->severity = PackageRemark::Warning;
+            remark->packageName = name;
+            remark->message = tr("Le fichier %1 se trouve également dans %2").arg(file, it.value());
             
-            if (enrg.path == file)
-            {
-                // Ah, ce fichier est déjà dedans.
-                PackageRemark *remark = new PackageRemark;
+            src->addRemark(remark);
             
-                remark->severity = PackageRemark::Warning;
-                remark->packageName = name;
-                remark->message = tr("Le fichier %1 se trouve également dans %2").arg(file, enrg.package);
-                
-                src->addRemark(remark);
-                
-                // Changer le package de cet enregistrement pour que les éventuels futurs messages
-                // en rapport avec ce fichier apportent plus d'informations.
-                enrg.package = name;
-                
-                // On a trouvé un fichier, pas la peine de continuer
-                found = true;
-                break;
-            }
+            // Changer le package de cet enregistrement pour que les éventuels futurs messages
+            // en rapport avec ce fichier apportent plus d'informations.
+            it.value() = name;
         }
-        
-        if (!found)
+        else
         {
             // On n'a pas encore le fichier
-            Enrg enrg;
-            
-            enrg.path = file;
-            enrg.package = name;
-            
-            enrgs.append(enrg);
+            enrgs.insert(file, name);
         }
     }
 }
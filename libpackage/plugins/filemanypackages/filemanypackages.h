@@ -24,7 +24,7 @@
 #define __FILEMANYPACKAGES_H__
 
 #include <QObject>
-#include <QList>
+#include <QHash>
 
 #include <QtPlugin>
 
@@ -50,13 +50,7 @@ class FileManyPackages : public QObject, public PackageSourceInterface
     private:
         PackageSource *src;
         
-        struct Enrg
-        {
-            QString path;
-            QString package;
-        };
-        
-        QList<Enrg> enrgs;
+        QHash<QString, QString> enrgs;  // (chemin, dernier paquet le contenant)
 };
 
 #endif
\ No newline at end of file
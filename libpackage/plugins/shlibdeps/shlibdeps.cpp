@@ -27,6 +27,7 @@
 #include <packagemetadata.h>
 
 #include <gelf.h>
+#include <elf.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -35,6 +36,7 @@
 #include <QDomElement>
 #include <QDomDocument>
 #include <QRegExp>
+#include <QtConcurrentMap>
 
 #include <QtDebug>
 
@@ -62,11 +64,38 @@ void ShLibDeps::init(PackageMetaData* md, PackageSource* src)
 {
     this->src = src;
     this->md = md;
+    
+    providers.clear();
+    localPatterns.clear();
+    
+    // Compiler une fois pour toutes les motifs des paquets binaires de la bonne architecture
+    QDomElement package = md->documentElement().firstChildElement("package");
+    
+    while (!package.isNull())
+    {
+        QString arch = package.attribute("arch");
+        
+        if (arch == "all" || arch == "any" || arch == SETUP_ARCH)
+        {
+            QDomElement files = package.firstChildElement("files");
+            
+            while (!files.isNull())
+            {
+                localPatterns.append(qMakePair(package.attribute("name"),
+                                               QRegExp(files.attribute("pattern", "*"), Qt::CaseSensitive, QRegExp::Wildcard)));
+                
+                files = files.nextSiblingElement("files");
+            }
+        }
+        
+        package = package.nextSiblingElement("package");
+    }
 }
 
 void ShLibDeps::end()
 {
-    return;
+    providers.clear();
+    localPatterns.clear();
 }
 
 static void getSection32(QByteArray &ba, Elf32_Shdr *shdr, Elf_Scn *scn)
@@ -98,13 +127,15 @@ struct Pkg
     bool local;
 };
 
-void ShLibDeps::processPackage(const QString& name, QStringList& files, bool isSource)
+struct ElfDeps
 {
-    if (isSource || error) return;   // On ne s'occupe pas des sources
-        
-    QByteArray buildRoot = src->option(PackageSource::BuildDir, QVariant()).toByteArray();
-    
-    // Lister les fichiers
+    QList<QByteArray> needs;
+    QList<QByteArray> runpaths;
+};
+
+static ElfDeps scanElf(const QByteArray &path)
+{
+    ElfDeps rs;
     Elf *e;
     int fd;
     char *sname;
@@ -117,146 +148,250 @@ void ShLibDeps::processPackage(const QString& name, QStringList& files, bool isS
     size_t shstrndx;
     
     QByteArray dynamic, dynstr;
-    QList<QByteArray> needs, runpaths;
+    char magic[SELFMAG];
     
-    runpaths << "/lib" << "/usr/lib";
+    // Essayer d'ouvrir ce fichier
+    fd = open(path.constData(), O_RDONLY, 0);
     
-    for (int i=0; i<files.count(); ++i)
+    if (fd < 0) return rs;
+    
+    // La plupart des fichiers ne sont pas des ELF, les reconnaître sans libelf
+    if (read(fd, magic, SELFMAG) != SELFMAG || memcmp(magic, ELFMAG, SELFMAG) != 0)
     {
-        const QString &file = files.at(i);
-        
-        // Essayer d'ouvrir ce fichier
-        fd = open((buildRoot + file).toUtf8().constData(), O_RDONLY, 0);
-        
-        if (fd < 0) continue;
-        
-        // Ouvrir ELF
-        e = elf_begin(fd, ELF_C_READ, NULL);
-        
-        if (e == NULL)
+        close(fd);
+        return rs;
+    }
+    
+    // Ouvrir ELF, le fichier est mappé en mémoire plutôt que lu
+    e = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+    
+    if (e == NULL)
+    {
+        close(fd);
+        return rs;
+    }
+    
+    if (elf_kind(e) != ELF_K_ELF || elf_getshdrstrndx(e, &shstrndx) != 0)
+    {
+        elf_end(e);
+        close(fd);
+        return rs;
+    }
+    
+    int eclass =  gelf_getclass(e);
+    
+    if (eclass == ELFCLASSNONE)
+    {
+        elf_end(e);
+        close(fd);
+        return rs;
+    }
+    
+    bool is32 = (eclass == ELFCLASS32);
+    
+    // Parcourir les sections
+    scn = NULL;
+    
+    bool err = false;
+    
+    while ((scn = elf_nextscn(e, scn)) != NULL)
+    {
+        if (is32)
         {
-            close(fd);
-            continue;
+            shdr32 = elf32_getshdr(scn);
+            
+            if (shdr32 == NULL)
+            {
+                err = true;
+                break;
+            }
         }
-        
-        if (elf_kind(e) != ELF_K_ELF || elf_getshdrstrndx(e, &shstrndx) != 0)
+        else
         {
-            elf_end(e);
-            close(fd);
-            continue;
+            shdr64 = elf64_getshdr(scn);
+            
+            if (shdr64 == NULL)
+            {
+                err = true;
+                break;
+            }
         }
         
-        int eclass =  gelf_getclass(e);
+        if ((sname = elf_strptr(e, shstrndx, (is32 ? shdr32->sh_name : shdr64->sh_name))) == NULL)
+        {   
+            err = true;
+            break;
+        }
         
-        if (eclass == ELFCLASSNONE)
+        if (strcmp(sname, ".dynamic") == 0)
         {
-            elf_end(e);
-            close(fd);
-            continue;
+            if (is32) getSection32(dynamic, shdr32, scn);
+            else getSection64(dynamic, shdr64, scn);
         }
+        else if (strcmp(sname, ".dynstr") == 0)
+        {
+            if (is32) getSection32(dynstr, shdr32, scn);
+            else getSection64(dynstr, shdr64, scn);
+        }
+    }
+    
+    if (dynamic.size() == 0 || dynstr.size() == 0) err = true;
+    
+    if (err)
+    {
+        elf_end(e);
+        close(fd);
+        return rs;
+    }
+    
+    // Explorer dynamic, qui contient des enregistrements de type GElf_Dyn
+    dyn32 = (const Elf32_Dyn *)dynamic.constData();
+    dyn64 = (const Elf64_Dyn *)dyn32;
+    
+    int j = 0;
+    QByteArray ba;
+    
+    while (j * (is32 ? sizeof(Elf32_Dyn) : sizeof(Elf64_Dyn)) <= dynamic.size())
+    {
+        int tag = (is32 ? dyn32->d_tag : dyn64->d_tag);
+        int dptr = (is32 ? dyn32->d_un.d_ptr : dyn64->d_un.d_ptr);
         
-        bool is32 = (eclass == ELFCLASS32);
-        
-        // Parcourir les sections
-        scn = NULL;
-        dynamic.clear();
-        dynstr.clear();
-        
-        bool err = false;
-        
-        while ((scn = elf_nextscn(e, scn)) != NULL)
+        if (tag == DT_NEEDED && dptr < dynstr.size())
         {
-            if (is32)
-            {
-                shdr32 = elf32_getshdr(scn);
-                
-                if (shdr32 == NULL)
-                {
-                    err = true;
-                    break;
-                }
-            }
-            else
-            {
-                shdr64 = elf64_getshdr(scn);
-                
-                if (shdr64 == NULL)
-                {
-                    err = true;
-                    break;
-                }
-            }
+            const char *tmp = dynstr.constData();
+            tmp += dptr;
+            ba = QByteArray(tmp);
             
-            if ((sname = elf_strptr(e, shstrndx, (is32 ? shdr32->sh_name : shdr64->sh_name))) == NULL)
-            {   
-                err = true;
-                break;
+            if (!rs.needs.contains(ba))
+            {
+                rs.needs.append(ba);
             }
+        }
+        else if ((tag == DT_RUNPATH || tag == DT_RPATH) && dptr < dynstr.size())
+        {
+            const char *tmp = dynstr.constData();
+            tmp += dptr;
+            ba = QByteArray(tmp);
             
-            if (strcmp(sname, ".dynamic") == 0)
+            if (!rs.runpaths.contains(ba))
             {
-                if (is32) getSection32(dynamic, shdr32, scn);
-                else getSection64(dynamic, shdr64, scn);
+                rs.runpaths.append(ba);
             }
-            else if (strcmp(sname, ".dynstr") == 0)
+        }
+        
+        dyn32++;
+        dyn64++;
+        j++;
+    }
+    
+    // Fermer le tout
+    elf_end(e);
+    close(fd);
+    
+    return rs;
+}
+
+struct ElfScanner
+{
+    ElfScanner(const QByteArray &_buildRoot) : buildRoot(_buildRoot) {}
+    
+    typedef ElfDeps result_type;
+    
+    ElfDeps operator()(const QString &file) const
+    {
+        return scanElf((buildRoot + file).toUtf8());
+    }
+    
+    QByteArray buildRoot;
+};
+
+ShLibDeps::Provider ShLibDeps::provider(PackageSystem *ps, const QByteArray &buildRoot, const QString &path)
+{
+    // Le résultat ne change pas pendant la construction, chaque chemin n'est cherché qu'une fois
+    QHash<QString, Provider>::const_iterator cached = providers.constFind(path);
+    
+    if (cached != providers.constEnd())
+    {
+        return cached.value();
+    }
+    
+    Provider rs;
+    rs.kind = Provider::None;
+    
+    if (QFile::exists(buildRoot + path))
+    {
+        // Fichier construit par nous-même : chercher le binaire qui le contient
+        for (int i=0; i<localPatterns.count(); ++i)
+        {
+            if (localPatterns.at(i).second.exactMatch(path))
             {
-                if (is32) getSection32(dynstr, shdr32, scn);
-                else getSection64(dynstr, shdr64, scn);
+                // On a trouvé le binaire qui contient la bibliothèque
+                rs.kind = Provider::Local;
+                rs.name = localPatterns.at(i).first;
+                rs.version = "{{version}}";
+                
+                providers.insert(path, rs);
+                return rs;
             }
         }
-        
-        if (dynamic.size() == 0 || dynstr.size() == 0) err = true;
-        
-        if (err)
+    }
+    
+    // Utiliser la BDD LPM pour trouver quel paquet contient ce fichier, s'il existe
+    QVector<PackageFile *> pfiles = ps->files(path.mid(1));
+    
+    foreach (PackageFile *file, pfiles)
+    {
+        if (file->package() != 0 && rs.kind == Provider::None)
         {
-            elf_end(e);
-            close(fd);
-            continue;
+            Package *pkg = file->package();
+            
+            // Le paquet est nécessairement installé puisqu'on s'en est servi pour compiler
+            // S'assurer que c'est cette version dont on dépend
+            if ((pkg->flags() & Package::Installed) != 0)
+            {
+                rs.kind = Provider::Installed;
+                rs.name = pkg->name();
+                rs.version = pkg->version();
+            }
         }
         
-        // Explorer dynamic, qui contient des enregistrements de type GElf_Dyn
-        dyn32 = (const Elf32_Dyn *)dynamic.constData();
-        dyn64 = (const Elf64_Dyn *)dyn32;
-        
-        int j = 0;
-        QByteArray ba;
+        delete file;
+    }
+    
+    providers.insert(path, rs);
+    return rs;
+}
+
+void ShLibDeps::processPackage(const QString& name, QStringList& files, bool isSource)
+{
+    if (isSource || error) return;   // On ne s'occupe pas des sources
         
-        while (j * (is32 ? sizeof(Elf32_Dyn) : sizeof(Elf64_Dyn)) <= dynamic.size())
+    QByteArray buildRoot = src->option(PackageSource::BuildDir, QVariant()).toByteArray();
+    QList<QByteArray> needs, runpaths;
+    
+    runpaths << "/lib" << "/usr/lib";
+    
+    // Lister les fichiers. Ils sont lus en parallèle, puis les résultats sont fusionnés
+    // dans l'ordre des fichiers
+    QList<ElfDeps> deps = QtConcurrent::blockingMapped<QList<ElfDeps> >(files, ElfScanner(buildRoot));
+    
+    foreach (const ElfDeps &dep, deps)
+    {
+        foreach (const QByteArray &need, dep.needs)
         {
-            int tag = (is32 ? dyn32->d_tag : dyn64->d_tag);
-            int dptr = (is32 ? dyn32->d_un.d_ptr : dyn64->d_un.d_ptr);
-            
-            if (tag == DT_NEEDED && dptr < dynstr.size())
+            if (!needs.contains(need))
             {
-                const char *tmp = dynstr.constData();
-                tmp += dptr;
-                ba = QByteArray(tmp);
-                
-                if (!needs.contains(ba))
-                {
-                    needs.append(ba);
-                }
+                needs.append(need);
             }
-            else if ((tag == DT_RUNPATH || tag == DT_RPATH) && dptr < dynstr.size())
+        }
+        
+        foreach (const QByteArray &runpath, dep.runpaths)
+        {
+            if (!runpaths.contains(runpath))
             {
-                const char *tmp = dynstr.constData();
-                tmp += dptr;
-                ba = QByteArray(tmp);
-                
-                if (!runpaths.contains(ba))
-                {
-                    runpaths.append(ba);
-                }
+                runpaths.append(runpath);
             }
-            
-            dyn32++;
-            dyn64++;
-            j++;
         }
-        
-        // Fermer le tout
-        elf_end(e);
-        close(fd);
     }
     
     // Voir si on sait initialiser le PackageSystem de src
@@ -289,7 +424,6 @@ void ShLibDeps::processPackage(const QString& name, QStringList& files, bool isS
     
     // Explorer les needs dans runpaths pour trouver les paquets les contenant, et leurs versions
     // Si un fichier n'est pas trouvé, et ne se trouve dans dans buildDir
-    QVector<PackageFile *> pfiles;
     QList<Pkg> pkgs;
     Pkg pkg;
     
@@ -300,78 +434,22 @@ void ShLibDeps::processPackage(const QString& name, QStringList& files, bool isS
         
         foreach (const QByteArray &runpath, runpaths)
         {
-            QString pth = QString::fromUtf8(runpath + "/" + need);
+            Provider p = provider(ps, buildRoot, QString::fromUtf8(runpath + "/" + need));
             
-            if (QFile::exists(buildRoot + pth))
+            if (p.kind == Provider::Local)
             {
-                // Fichier construit par nous-même : chercher le binaire qui le contient
-                QDomElement package = md->documentElement().firstChildElement("package");
+                pkg.name = p.name;
+                pkg.version = p.version;
+                pkg.local = true;
                 
-                while (!package.isNull())
-                {
-                    QString arch = package.attribute("arch");
-                    
-                    // Le paquet doit être de la bonne architecture
-                    if (arch == "all" || arch == "any" || arch == SETUP_ARCH)
-                    {
-                        // Explorer les éléments files de ce paquet et voir si notre fichier correspond
-                        QDomElement files = package.firstChildElement("files");
-                        
-                        while (!files.isNull())
-                        {
-                            QRegExp regex(files.attribute("pattern", "*"), Qt::CaseSensitive, QRegExp::Wildcard);
-                            
-                            if (regex.exactMatch(pth))
-                            {
-                                // On a trouvé le binaire qui contient la bibliothèque
-                                pkg.name = package.attribute("name");
-                                pkg.version = "{{version}}";
-                                pkg.local = true;
-                                
-                                pkgs.append(pkg);
-                                my = true;
-                                break;
-                            }
-                            
-                            files = files.nextSiblingElement("files");
-                        }
-                        
-                        if (my) break;
-                    }
-                    package = package.nextSiblingElement("package");
-                }
-                
-                if (my) break;
+                pkgs.append(pkg);
+                my = true;
+                break;
             }
-            
-            // Utiliser la BDD LPM pour trouver quel paquet contient ce fichier, s'il existe
-            pfiles.clear();
-            pth.remove(0, 1);
-            
-            pfiles = ps->files(pth);
-            
-            foreach (PackageFile *file, pfiles)
+            else if (p.kind == Provider::Installed)
             {
-                if (file->package() != 0)
-                {
-                    Package *pkg = file->package();
-                    
-                    // Le paquet est nécessairement installé puisqu'on s'en est servi pour compiler
-                    // S'assurer que c'est cette version dont on dépend
-                    if ((pkg->flags() & Package::Installed) == 0)
-                    {
-                        delete file;
-                        continue;
-                    }
-                    
-                    dname = pkg->name();
-                    version = pkg->version();
-                    
-                    delete file;
-                    break;
-                }
-                
-                delete file;
+                dname = p.name;
+                version = p.version;
             }
         }
         
@@ -24,6 +24,10 @@
 #define __SHLIBDEPS_H__
 
 #include <QObject>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QRegExp>
 #include <QtPlugin>
 
 #include <packagesource.h>
@@ -49,6 +53,26 @@ class ShLibDeps : public QObject, public PackageSourceInterface
         PackageSource *src;
         PackageMetaData *md;
         bool error;
+        
+        // Paquet fournissant un fichier, mis en cache pour toute la construction
+        struct Provider
+        {
+            enum Kind
+            {
+                None,       // Aucun paquet ne contient ce fichier
+                Local,      // Fichier construit par cette source
+                Installed   // Fichier d'un paquet installé
+            };
+            
+            Kind kind;
+            QString name;
+            QString version;
+        };
+        
+        QHash<QString, Provider> providers;             // (chemin, fournisseur)
+        QList<QPair<QString, QRegExp> > localPatterns;  // (paquet binaire, motif <files>)
+        
+        Provider provider(PackageSystem *ps, const QByteArray &buildRoot, const QString &path);
 };
 
 #endif
\ No newline at end of file
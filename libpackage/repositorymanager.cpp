@@ -25,6 +25,7 @@
 #include "packagesystem.h"
 #include "filepackage.h"
 #include "packagemetadata.h"
+#include "databasereader.h"
 
 #include <QSettings>
 #include <QRegExp>
@@ -33,6 +34,11 @@
 #include <QProcess>
 #include <QDateTime>
 #include <QVector>
+#include <QHash>
+#include <QPair>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentMap>
 
 #include <QtSql>
 #include <QtXml>
@@ -59,8 +65,16 @@ struct RepositoryManager::Private
     QRegExp slugRegex, slugRegex2;
     bool websiteIntegration;
     
+    // Identifiants des dossiers de packages_directory, par chemin. Vidé à
+    // chaque rollback, les dossiers insérés dans la transaction n'existent plus
+    QHash<QString, int> directories;
+    
     // Fonctions
     bool registerString(QSqlQuery &query, int package_id, const QString &lang, const QString &cont, int type, int changelog_id = 0);
+    bool importFiles(QSqlQuery &query, int package_id, const QVector<PackageFile *> &files);
+    int directoryId(QSqlQuery &select, QSqlQuery &insert, const QString &path);
+    bool queryError(const QSqlQuery &query, bool rollback);
+    void rollback();
     bool writeXZ(const QString &fileName, const QByteArray &data);
     QString slugify(const QString &str);
     int sourcePackageId(const QString &name);
@@ -637,11 +651,234 @@ bool RepositoryManager::includeSource(const QString &fileName, bool appendHistor
     return true;
 }
 
-struct DirectoryId
+// Nombre de lignes insérées par requête dans packages_file
+#define FILES_PER_INSERT 500
+
+bool RepositoryManager::Private::queryError(const QSqlQuery &query, bool rollback)
+{
+    PackageError *err = new PackageError;
+    err->type = PackageError::QueryError;
+    err->info = query.lastQuery();
+    
+    ps->setLastError(err);
+    
+    if (rollback)
+    {
+        this->rollback();
+    }
+    
+    return false;
+}
+
+void RepositoryManager::Private::rollback()
+{
+    db.rollback();
+    directories.clear();
+}
+
+int RepositoryManager::Private::directoryId(QSqlQuery &select, QSqlQuery &insert, const QString &path)
 {
-    QString name;
+    // path est par exemple usr/lib/terminfo/x, 0 est la racine
+    if (path.isEmpty())
+    {
+        return 0;
+    }
+    
+    QHash<QString, int>::const_iterator it = directories.constFind(path);
+    
+    if (it != directories.constEnd())
+    {
+        return it.value();
+    }
+    
+    int pos = path.lastIndexOf('/');
+    QString parentPath = (pos == -1 ? QString() : path.left(pos));
+    QString name = path.mid(pos + 1);
+    int parentId = directoryId(select, insert, parentPath);
     int id;
-};
+    
+    if (parentId == -1)
+    {
+        return -1;
+    }
+    
+    select.bindValue(0, name);
+    select.bindValue(1, parentId);
+    
+    if (!select.exec())
+    {
+        queryError(select, false);
+        return -1;
+    }
+    
+    if (select.next())
+    {
+        // Le dossier existe déjà, ok
+        id = select.value(0).toInt();
+    }
+    else
+    {
+        // Le dossier n'existe pas déjà, le créer
+        insert.bindValue(0, parentId);
+        insert.bindValue(1, name);
+        insert.bindValue(2, parentPath);
+        
+        if (!insert.exec())
+        {
+            queryError(insert, false);
+            return -1;
+        }
+        
+        id = insert.lastInsertId().toInt();
+    }
+    
+    directories.insert(path, id);
+    
+    return id;
+}
+
+bool RepositoryManager::Private::importFiles(QSqlQuery &query, int package_id, const QVector<PackageFile *> &files)
+{
+    // Les fichiers du paquet sont remplacés d'un seul coup
+    bool transaction = db.transaction();
+    QString sql;
+    
+    // Fichiers déjà enregistrés : (dossier, nom) => (id, flags)
+    QHash<QPair<int, QString>, QPair<int, int> > existing;
+    
+    sql = "SELECT id, directory_id, name, flags FROM packages_file WHERE package_id=%1;";
+    
+    if (!query.exec(sql.arg(package_id)))
+    {
+        return queryError(query, transaction);
+    }
+    
+    while (query.next())
+    {
+        existing.insert(qMakePair(query.value(1).toInt(), query.value(2).toString()),
+                        qMakePair(query.value(0).toInt(), query.value(3).toInt()));
+    }
+    
+    // Requêtes préparées
+    QSqlQuery select(db), insert(db), update(db);
+    
+    if (!select.prepare("SELECT id FROM packages_directory WHERE name=? COLLATE utf8_bin AND directory_id=?;"))
+    {
+        return queryError(select, transaction);
+    }
+    
+    if (!insert.prepare("INSERT INTO packages_directory (directory_id, name, path) VALUES (?, ?, ?);"))
+    {
+        return queryError(insert, transaction);
+    }
+    
+    if (!update.prepare("UPDATE packages_file SET flags=? WHERE id=?;"))
+    {
+        return queryError(update, transaction);
+    }
+    
+    // Explorer les fichiers, n'insérer que les nouveaux
+    QStringList values;
+    
+    for (int i=0; i<files.count(); ++i)
+    {
+        PackageFile *file = files.at(i);
+        QString path = file->path();
+        int flags = file->flags();
+        int pos = path.lastIndexOf('/');
+        int dirId = directoryId(select, insert, (pos == -1 ? QString() : path.left(pos)));
+        QString name = path.mid(pos + 1);
+        
+        if (dirId == -1)
+        {
+            if (transaction) rollback();
+            return false;
+        }
+        
+        QPair<int, QString> key(dirId, name);
+        
+        if (existing.contains(key))
+        {
+            // Fichier déjà présent, seuls ses flags ont pu changer
+            QPair<int, int> row = existing.take(key);
+            
+            if (row.second != flags)
+            {
+                update.bindValue(0, flags);
+                update.bindValue(1, row.first);
+                
+                if (!update.exec())
+                {
+                    return queryError(update, transaction);
+                }
+            }
+            
+            continue;
+        }
+        
+        values.append(QString("(%1, %2, '%3', %4)")
+                        .arg(package_id)
+                        .arg(dirId)
+                        .arg(e(name))
+                        .arg(flags));
+        
+        if (values.count() == FILES_PER_INSERT)
+        {
+            sql = "INSERT INTO packages_file (package_id, directory_id, name, flags) VALUES " + values.join(", ") + ";";
+            values.clear();
+            
+            if (!query.exec(sql))
+            {
+                return queryError(query, transaction);
+            }
+        }
+    }
+    
+    if (!values.isEmpty())
+    {
+        sql = "INSERT INTO packages_file (package_id, directory_id, name, flags) VALUES " + values.join(", ") + ";";
+        
+        if (!query.exec(sql))
+        {
+            return queryError(query, transaction);
+        }
+    }
+    
+    // Supprimer les fichiers que le paquet n'a plus
+    QList<QPair<int, int> > removed = existing.values();
+    
+    for (int i=0; i<removed.count(); i += FILES_PER_INSERT)
+    {
+        QStringList ids;
+        
+        for (int j=i; j<removed.count() && j<i + FILES_PER_INSERT; ++j)
+        {
+            ids.append(QString::number(removed.at(j).first));
+        }
+        
+        sql = "DELETE FROM packages_file WHERE id IN (" + ids.join(", ") + ");";
+        
+        if (!query.exec(sql))
+        {
+            return queryError(query, transaction);
+        }
+    }
+    
+    if (transaction && !db.commit())
+    {
+        PackageError *err = new PackageError;
+        err->type = PackageError::QueryError;
+        err->info = "COMMIT";
+        err->more = db.lastError().text();
+        
+        ps->setLastError(err);
+        rollback();
+        
+        return false;
+    }
+    
+    return true;
+}
 
 struct WikiPage
 {
@@ -716,24 +953,101 @@ static QString iconFileName(const QString &name, const QString &version, const Q
 
 bool RepositoryManager::includePackage(const QString &fileName)
 {
-    // Ouvrir le paquet
-    FilePackage *fpkg;
-    Package *pkg;
-    PackageMetaData *md;
+    // Ouvrir le paquet. Son hash est publié, il est toujours recalculé
+    FilePackage *fpkg = new FilePackage(fileName, d->ps, d->ps->databaseReader(), Solver::None);
+    
+    // Lire toute l'archive avant de la valider, comme includePackages()
+    fpkg->setUseIndex(false);
+    fpkg->metadataContents();
     
-    if (!d->ps->package(fileName, QString(), pkg))
+    if (!fpkg->isValid())
     {
+        PackageError *err = new PackageError;
+        err->type = PackageError::PackageNotFound;
+        err->info = fileName;
+        
+        d->ps->setLastError(err);
+        
+        delete fpkg;
         return false;
     }
     
-    fpkg = static_cast<FilePackage *>(pkg);
+    return includeFilePackage(fpkg);
+}
+
+struct PackageReader
+{
+    typedef FilePackage *result_type;
     
-    if (fpkg == 0)
+    PackageReader(PackageSystem *_ps, DatabaseReader *_psd, QThread *_thread) 
+        : ps(_ps), psd(_psd), thread(_thread) {}
+    
+    FilePackage *operator()(const QString &fileName) const
     {
-        return false;
+        // Appelé dans un thread du QThreadPool : hash, décompression et métadonnées
+        FilePackage *fpkg = new FilePackage(0, fileName, ps, psd, Solver::None);
+        
+        // Le hash du paquet est publié, il est toujours recalculé. Le contenu de l'archive
+        // est lu à la demande, le lire dès maintenant dans ce thread
+        fpkg->setUseIndex(false);
+        fpkg->metadataContents();
+        fpkg->moveToThread(thread);
+        
+        return fpkg;
     }
     
-    md = fpkg->metadata();
+    PackageSystem *ps;
+    DatabaseReader *psd;
+    QThread *thread;
+};
+
+bool RepositoryManager::includePackages(const QStringList &fileNames)
+{
+    // Lire les paquets par groupes, pour ne pas tous les garder en mémoire
+    int batch = QThreadPool::globalInstance()->maxThreadCount() * 2;
+    PackageReader reader(d->ps, d->ps->databaseReader(), thread());
+    
+    for (int i=0; i<fileNames.count(); i += batch)
+    {
+        QList<FilePackage *> fpkgs = QtConcurrent::blockingMapped<QList<FilePackage *> >(fileNames.mid(i, batch), reader);
+        
+        // Les requêtes SQL sont faites dans ce thread, sur l'unique connexion
+        for (int j=0; j<fpkgs.count(); ++j)
+        {
+            FilePackage *fpkg = fpkgs.at(j);
+            
+            fpkg->setParent(d->ps);
+            
+            if (!fpkg->isValid())
+            {
+                PackageError *err = new PackageError;
+                err->type = PackageError::PackageNotFound;
+                err->info = fileNames.at(i + j);
+                
+                d->ps->setLastError(err);
+                
+                qDeleteAll(fpkgs.mid(j));
+                return false;
+            }
+            
+            bool rs = includeFilePackage(fpkg);
+            
+            delete fpkg;
+            
+            if (!rs)
+            {
+                qDeleteAll(fpkgs.mid(j + 1));
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+bool RepositoryManager::includeFilePackage(FilePackage *fpkg)
+{
+    PackageMetaData *md = fpkg->metadata();
     md->setCurrentPackage(fpkg->name());
     
     QDomElement package = md->currentPackageElement();
@@ -979,144 +1293,11 @@ bool RepositoryManager::includePackage(const QString &fileName)
     }
     
     // Liste des fichiers
-    QStringList fileParts;
-    
-    sql = "DELETE FROM packages_file WHERE package_id=%1;";
-          
-    if (!query.exec(sql.arg(package_id)))
+    if (!d->importFiles(query, package_id, fpkg->files()))
     {
-        PackageError *err = new PackageError;
-        err->type = PackageError::QueryError;
-        err->info = query.lastQuery();
-        
-        d->ps->setLastError(err);
-        
         return false;
     }
     
-    QVector<PackageFile *> pkgfiles = fpkg->files();
-    QVector<DirectoryId> dirIds;
-    
-    for (int j=0; j<pkgfiles.count(); ++j)
-    {
-        PackageFile *file = pkgfiles.at(j);
-        QString fileName = file->path();
-        int flags = file->flags();
-        
-        // fileName est par exemple usr/lib/terminfo/x/xterm+pcc2
-        // Découper ce nom de fichier suivant '/'
-        fileParts = fileName.split('/');
-        
-        // Explorer ces morceaux
-        QString dirPath;
-        int dirId = 0;
-        for (int i=0; i<fileParts.count(); ++i)
-        {
-            const QString &part = fileParts.at(i);
-            
-            if (i < fileParts.count() - 1)
-            {
-                // Dossier, vérifier s'il existe
-                // Voir si on n'a rien en cache
-                if (i < dirIds.count() && dirIds.at(i).name == part)
-                {
-                    dirId = dirIds.at(i).id;
-                }
-                else
-                {
-                    // Pas en cache
-                    sql = " SELECT id \
-                            FROM packages_directory \
-                            WHERE name='%1' COLLATE utf8_bin AND directory_id=%2;";
-                    
-                    if (!query.exec(sql
-                            .arg(e(part))
-                            .arg(dirId)))
-                    {
-                        PackageError *err = new PackageError;
-                        err->type = PackageError::QueryError;
-                        err->info = query.lastQuery();
-                        
-                        d->ps->setLastError(err);
-                        
-                        return false;
-                    }
-                    
-                    if (query.next())
-                    {
-                        // Le dossier existe déjà, ok
-                        dirId = query.value(0).toInt();
-                    }
-                    else
-                    {
-                        // Le dossier n'existe pas déjà, le créer
-                        sql = " INSERT INTO packages_directory \
-                                (directory_id, name, path) \
-                                VALUES (%1, '%2', '%3');";
-                        
-                        if (!query.exec(sql
-                                .arg(dirId)
-                                .arg(e(part))
-                                .arg(e(dirPath))))
-                        {
-                            PackageError *err = new PackageError;
-                            err->type = PackageError::QueryError;
-                            err->info = query.lastQuery();
-                            
-                            d->ps->setLastError(err);
-                            
-                            return false;
-                        }
-                        
-                        // Récupérer l'ID du dossier
-                        dirId = query.lastInsertId().toInt();
-                    }
-                    
-                    // L'insérer dans le cache
-                    dirIds.resize(i);
-                    
-                    DirectoryId did;
-                    did.name = part;
-                    did.id = dirId;
-                    dirIds.append(did);
-                }
-                
-                // Ajouter cet élément au path du dossier
-                if (!dirPath.isEmpty())
-                {
-                    dirPath += '/';
-                }
-                
-                dirPath += part;
-            }
-            else
-            {
-                // Fichier, on sait que dirId pointe sur son dossier parent.
-                // Il faut juste créer ce fichier.
-                // En effet, on les a tous supprimés avant (pour éviter les 
-                // problèmes de mise à jour.
-                sql = " INSERT INTO packages_file \
-                        (package_id, directory_id, name, flags) \
-                        VALUES (%1, %2, '%3', %4);";
-                
-                if (!query.exec(sql
-                        .arg(package_id)
-                        .arg(dirId)
-                        .arg(e(part))
-                        .arg(flags)))
-                {
-                    PackageError *err = new PackageError;
-                    err->type = PackageError::QueryError;
-                    err->info = query.lastQuery();
-                    
-                    d->ps->setLastError(err);
-                    
-                    return false;
-                }
-            }
-        }
-    }
-    
     // Chaînes
     QDomElement el = package.firstChildElement();
     QList<WikiPage> wikiPages;
@@ -1371,6 +1552,8 @@ bool RepositoryManager::includePackage(const QString &fileName)
     }
     
     // Enregistrer le changelog, sans passer par md->changelog() car on a besoin des langues
+    md->ensureParsed();
+    
     QDomElement changelog = md->documentElement().firstChildElement("changelog").firstChildElement("entry");
     QDateTime maxdt, mydt;
     int m_distro_id, changelogType = ChangeLogEntry::LowPriority, changelogID;
@@ -29,11 +29,13 @@
 #define __REPOSITORYMANAGER_H__
 
 #include <QObject>
+#include <QStringList>
 
 namespace Logram
 {
     
 class PackageSystem;
+class FilePackage;
 
 /**
  * @brief Gestion des dépôts
@@ -117,6 +119,21 @@ class RepositoryManager : public QObject
          */
         bool includePackage(const QString &fileName);
         
+        /**
+         * @brief Inclus plusieurs paquets binaires
+         * 
+         * Comme includePackage(), mais les paquets sont lus (hash,
+         * décompression, analyse des métadonnées) en parallèle par le
+         * QThreadPool global. Les requêtes SQL restent faites dans l'ordre,
+         * dans le thread appelant, sur la connexion de RepositoryManager.
+         * 
+         * L'importation s'arrête au premier paquet qui échoue.
+         * 
+         * @param fileNames Noms des fichiers des paquets (*.lpk)
+         * @return True si tous les paquets ont été inclus, false sinon.
+         */
+        bool includePackages(const QStringList &fileNames);
+        
         /**
          * @brief Inclus un paquet source
          * 
@@ -151,6 +168,8 @@ class RepositoryManager : public QObject
         bool exp(const QStringList &distros);
         
     private:
+        bool includeFilePackage(FilePackage *fpkg);
+        
         struct Private;
         Private *d;
 };
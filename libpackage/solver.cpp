@@ -28,18 +28,77 @@
 #include "packagelist.h"
 
 #include <QList>
+#include <QHash>
+#include <QSet>
 #include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSettings>
+#include <QMutex>
+#include <QtConcurrentMap>
+#include <QThread>
+#include <QDir>
+#include <QTemporaryFile>
+#include <QCryptographicHash>
 
 #include <QtDebug>
 #include <QtScript>
 
 using namespace Logram;
 
+// Clef d'un noeud de paquet de la base de donnée dans databaseNodes
+static inline qint64 nodeKey(int index, Solver::Action action)
+{
+    return ((qint64)index << 3) | action;
+}
+
+// Action des enfants créés par une dépendance, Solver::None si elle est ignorée
+static Solver::Action dependAction(int dtype, Solver::Action action, bool installSuggests)
+{
+    if ((dtype == Depend::DependType && action == Solver::Install) ||
+        (dtype == Depend::Suggest && action == Solver::Install && installSuggests))
+    {
+        return Solver::Install;
+    }
+    else if ((dtype == Depend::Conflict || dtype == Depend::Replace) && action == Solver::Install)
+    {
+        return Solver::Remove;
+    }
+    else if (dtype == Depend::RevDep && action == Solver::Remove)
+    {
+        // La revdep est supprimée, les autres versions du paquet installées (voir childAction())
+        return Solver::Install;
+    }
+    
+    return Solver::None;
+}
+
+// Action du j-ième paquet d'un enfant : pour une revdep, le premier est supprimé
+static inline Solver::Action childAction(Solver::Action action, bool revdep, int j)
+{
+    return (revdep && j == 0 ? Solver::Remove : action);
+}
+
 struct Solver::Private
 {
     PackageSystem *ps;
     DatabaseReader *psd;
-    bool installSuggests, useDeps, useInstalled;
+    bool installSuggests, useDeps, useInstalled, parallelExpansion;
+    
+    // Cache des résultats
+    struct CachedPackage
+    {
+        int index;
+        Solver::Action action;
+        int upgrade;                // Index du nouveau paquet si mise à jour, -1 sinon
+        bool wanted;
+    };
+    
+    bool useCache, cached, choicesMade, listEnded;
+    QString cacheFile;
+    QByteArray generation;
+    QList<CachedPackage> cachedList;
+    QList<Package *> cachedPackages;
 
     struct WantedPackage
     {
@@ -50,6 +109,42 @@ struct Solver::Private
     QList<WantedPackage> wantedPackages;
     
     QVector<Solver::Node *> nodes;
+    QHash<qint64, Solver::Node *> databaseNodes;    // nodeKey(index, action) => noeud
+    
+    // Résultats des recherches dans la base de donnée, préchargés en parallèle
+    QHash<_Depend *, QVector<int> > dependPackagesCache;
+    QHash<int, QVector<int> > namePackagesCache;
+    
+    struct Expansion
+    {
+        QList<QPair<_Depend *, QVector<int> > > depends;
+        int name;                   // -1 si versions n'est pas renseigné
+        QVector<int> versions;
+        QVector<qint64> children;   // Clefs nodeKey(index, action) des enfants
+    };
+    
+    // Enfant d'un paquet de la base de donnée créé par une de ses dépendances
+    struct DependChild
+    {
+        _Depend *dep;
+        Solver::Action action;
+        bool revdep;                // Voir childAction()
+        QVector<int> pkgIndexes;
+    };
+    
+    struct Expander
+    {
+        typedef Expansion result_type;
+        
+        Expander(Private *_d) : d(_d) {}
+        
+        Expansion operator()(qint64 key) const
+        {
+            return d->expand(key);
+        }
+        
+        Private *d;
+    };
     Solver::Node *rootNode, *errorNode;
     
     struct Level
@@ -65,8 +160,24 @@ struct Solver::Private
     Solver::Node *choiceNode;
 
     // Fonctions
-    bool addNode(Package *package, Solver::Node *node);
+    Solver::Node *newNode(Package *package, int index, Solver::Action action);
+    bool addNode(Solver::Node *node);
     Node *checkPackage(int index, Solver::Action action, bool &ok, bool userWanted);
+    
+    int nodeFlags(Solver::Node *node);
+    bool sameName(Solver::Node *a, Solver::Node *b);
+    bool sameVersion(Solver::Node *a, Solver::Node *b);
+    void materialize(Solver::Node *node);
+    
+    bool readCache();
+    void writeCache(PackageList *list);
+    
+    Expansion expand(qint64 key);
+    void prefetch();
+    QVector<int> dependPackages(_Depend *dep);
+    QVector<int> namePackages(int name);
+    int updatedVersion(int index, _Package *mpkg, Solver::Action action, const QVector<int> &versions);
+    QVector<DependChild> dependChildren(int index, Solver::Action action, const QVector<int> &versions);
     bool addPkgs(const QVector<int> &pkgIndexes, Solver::Node *node, Solver::Action action, Solver::Node::Child *child, bool revdep = false);
     
     bool exploreNode(Solver::Node *node, bool &ended);
@@ -81,6 +192,12 @@ Solver::Solver(PackageSystem *ps, DatabaseReader *psd)
     d->ps = ps;
     d->useDeps = true;
     d->useInstalled = true;
+    d->installSuggests = false;
+    d->parallelExpansion = true;
+    d->useCache = false;
+    d->cached = false;
+    d->choicesMade = false;
+    d->listEnded = false;
     d->errorNode = 0;
     d->rootNode = 0;
 }
@@ -108,6 +225,8 @@ Solver::~Solver()
         delete node;
     }
     
+    qDeleteAll(d->cachedPackages);
+    
     delete d;
 }
 
@@ -126,6 +245,16 @@ void Solver::setInstallSuggests(bool enable)
     d->installSuggests = enable;
 }
 
+void Solver::setParallelExpansion(bool enable)
+{
+    d->parallelExpansion = enable;
+}
+
+void Solver::setUseCache(bool enable)
+{
+    d->useCache = enable;
+}
+
 void Solver::addPackage(const QString &nameStr, Action action)
 {
     Private::WantedPackage pkg;
@@ -140,13 +269,39 @@ bool Solver::solve()
 {
     // Créer le noeud principal
     d->ps->setLastError(0); // Effacer l'erreur
-    d->rootNode = new Node;
     
-    return d->addNode(0, d->rootNode);
+    // Les caches de prefetch() pointent dans la base de donnée mappée, qui a pu
+    // être remappée depuis un précédent appel
+    d->dependPackagesCache.clear();
+    d->namePackagesCache.clear();
+    
+    // Résultat déjà connu : l'arbre reste vide, list() utilisera le cache
+    if (d->useCache && d->readCache())
+    {
+        d->cached = true;
+        d->rootNode = d->newNode(0, -1, Solver::None);
+        
+        return true;
+    }
+    
+    if (d->parallelExpansion && QThread::idealThreadCount() > 1)
+    {
+        d->prefetch();
+    }
+    
+    d->rootNode = d->newNode(0, -1, Solver::None);
+    
+    return d->addNode(d->rootNode);
 }
 
 Solver::Node *Solver::root()
 {
+    // L'arbre entier devient accessible
+    foreach (Node *node, d->nodes)
+    {
+        d->materialize(node);
+    }
+    
     return d->rootNode;
 }
 
@@ -208,42 +363,36 @@ static void weightChildren(Solver::Node *node, Solver::Node *mainNode, bool weig
     {
         mainNode->minWeight += node->weight;
         
-        if (node->package)
+        switch (node->action)
         {
-            switch (node->package->action())
-            {
-                case Solver::Install:
-                    mainNode->minInstSize += node->package->installSize();
-                    mainNode->minDlSize += node->package->downloadSize();
-                    break;
-                case Solver::Remove:
-                case Solver::Purge:
-                    mainNode->minInstSize -= node->package->installSize();
-                    break;
-                default:
-                    break;
-            }
+            case Solver::Install:
+                mainNode->minInstSize += node->installSize;
+                mainNode->minDlSize += node->downloadSize;
+                break;
+            case Solver::Remove:
+            case Solver::Purge:
+                mainNode->minInstSize -= node->installSize;
+                break;
+            default:
+                break;
         }
     }
     else
     {
         mainNode->maxWeight += node->weight;
         
-        if (node->package)
+        switch (node->action)
         {
-            switch (node->package->action())
-            {
-                case Solver::Install:
-                    mainNode->maxInstSize += node->package->installSize();
-                    mainNode->maxDlSize += node->package->downloadSize();
-                    break;
-                case Solver::Remove:
-                case Solver::Purge:
-                    mainNode->maxInstSize -= node->package->installSize();
-                    break;
-                default:
-                    break;
-            }
+            case Solver::Install:
+                mainNode->maxInstSize += node->installSize;
+                mainNode->maxDlSize += node->downloadSize;
+                break;
+            case Solver::Remove:
+            case Solver::Purge:
+                mainNode->maxInstSize -= node->installSize;
+                break;
+            default:
+                break;
         }
     }
 }
@@ -347,7 +496,137 @@ static void minMaxWeight(Solver::Node *node)
     weightChildren(node, node, true);
 }
 
+/* Politique de pesage native */
+
+#define WEIGHT_PARALLEL_NODES 4096      // Nombre de noeuds à partir duquel le pesage se fait en parallèle
+
+struct WeightRule
+{
+    double base;                        // Poids de base de l'action
+    double downloadUnit;                // Octets téléchargés par point, 0 pour ignorer
+    double installUnit;                 // Octets installés par point, 0 pour ignorer
+};
+
+struct WeightPolicy
+{
+    bool script;                            // Clef Script : utiliser weight.qs à la place
+    WeightRule rules[Solver::Update + 1];   // Index : Solver::Action
+};
+
+static QMutex weightPolicyMutex;
+static QString weightPolicyFile;
+static QDateTime weightPolicyModified;
+static WeightPolicy weightPolicy;
+
+static WeightRule readWeightRule(QSettings &set, const QString &group)
+{
+    WeightRule rule;
+    
+    set.beginGroup(group);
+    rule.base = set.value("Base", 0).toDouble();
+    rule.downloadUnit = set.value("DownloadUnit", 0).toDouble();
+    rule.installUnit = set.value("InstallUnit", 0).toDouble();
+    set.endGroup();
+    
+    return rule;
+}
+
+static bool nativeWeightPolicy(const QString &fileName, WeightPolicy &rs)
+{
+    // Le fichier n'est relu que s'il a changé depuis la dernière fois
+    QMutexLocker locker(&weightPolicyMutex);
+    QFileInfo fi(fileName);
+    
+    if (!fi.exists())
+    {
+        return false;
+    }
+    
+    if (fileName != weightPolicyFile || fi.lastModified() != weightPolicyModified)
+    {
+        QSettings set(fileName, QSettings::IniFormat);
+        
+        weightPolicy.script = set.value("Script", false).toBool();
+        
+        // Les actions inconnues sont pesées comme des mises à jour, comme dans weight.qs
+        weightPolicy.rules[Solver::Install] = readWeightRule(set, "Install");
+        weightPolicy.rules[Solver::Remove] = readWeightRule(set, "Remove");
+        weightPolicy.rules[Solver::Purge] = readWeightRule(set, "Purge");
+        weightPolicy.rules[Solver::Update] = readWeightRule(set, "Update");
+        weightPolicy.rules[Solver::None] = weightPolicy.rules[Solver::Update];
+        
+        weightPolicyFile = fileName;
+        weightPolicyModified = fi.lastModified();
+    }
+    
+    rs = weightPolicy;
+    return true;
+}
+
+struct NodeWeighter
+{
+    NodeWeighter(const WeightPolicy &policy, Solver::Node *root) : policy(policy), root(root) {}
+    
+    void operator()(Solver::Node *node)
+    {
+        if (node == root) return;
+        
+        int action = node->action;
+        
+        if (action < Solver::None || action > Solver::Update)
+        {
+            action = Solver::Update;
+        }
+        
+        const WeightRule &rule = policy.rules[action];
+        
+        // Même calcul (flottant, puis tronqué) que weight.qs
+        double w = rule.base;
+        
+        if (rule.downloadUnit != 0) w += (node->downloadSize / rule.downloadUnit);
+        if (rule.installUnit != 0) w += (node->installSize / rule.installUnit);
+        
+        node->weight = (int)w;
+        node->flags |= Solver::Node::Weighted;
+    }
+    
+    WeightPolicy policy;
+    Solver::Node *root;
+};
+
 bool Solver::weight()
+{
+    // Politique native, sauf si elle n'existe pas ou demande le script QtScript
+    WeightPolicy policy;
+    
+    if (nativeWeightPolicy(d->ps->confRoot() + "/etc/lgrpkg/scripts/weight.conf", policy) && !policy.script)
+    {
+        NodeWeighter weighter(policy, d->rootNode);
+        
+        if (d->nodes.count() >= WEIGHT_PARALLEL_NODES)
+        {
+            QtConcurrent::blockingMap(d->nodes, weighter);
+        }
+        else
+        {
+            foreach (Node *node, d->nodes)
+            {
+                weighter(node);
+            }
+        }
+    }
+    else if (!scriptWeight())
+    {
+        return false;
+    }
+    
+    // Maintenant qu'on a le poids des paquets, calculer les min/max
+    minMaxWeight(d->rootNode);
+    
+    return true;
+}
+
+bool Solver::scriptWeight()
 {
     QScriptValue func, global;
     QScriptValueList args;
@@ -394,6 +673,7 @@ bool Solver::weight()
     
     foreach (Node *node, d->nodes)
     {
+        d->materialize(node);
         nd = new ScriptNode(node, this);
         olist.append(nd);
     }
@@ -403,9 +683,6 @@ bool Solver::weight()
     
     func.call(QScriptValue(), args);
     
-    // Maintenant qu'on a le poids des paquets, calculer les min/max
-    minMaxWeight(d->rootNode);
-    
     return true;
 }
 
@@ -418,7 +695,10 @@ bool Solver::beginList(bool &ended)
     d->choiceChild = 0;
     d->choiceNode = 0;
     
-    return d->exploreNode(d->rootNode, ended);
+    bool rs = d->exploreNode(d->rootNode, ended);
+    d->listEnded = (rs && ended);
+    
+    return rs;
 }
 
 bool Solver::continueList(int choice, bool &ended)
@@ -458,6 +738,7 @@ bool Solver::continueList(int choice, bool &ended)
         // Le noeud est bon, voir s'il correspond au choix
         if (index == choice)
         {
+            d->choicesMade = true;
             // Choix fait sur i
             d->choiceChild->chosenNode = i;
             break;
@@ -504,6 +785,7 @@ QVector<Solver::Node *> Solver::choices()
             continue;
         }
         
+        d->materialize(node);
         rs.append(node);
     }
     
@@ -564,6 +846,32 @@ PackageList *Solver::list()
     PackageList *rs = new PackageList(d->ps);
     rs->setDeletePackagesOnDelete(false);
     
+    if (d->cached)
+    {
+        foreach (const Private::CachedPackage &cpkg, d->cachedList)
+        {
+            DatabasePackage *pkg = new DatabasePackage(cpkg.index, d->ps, d->psd, cpkg.action);
+            
+            pkg->setWanted(cpkg.wanted);
+            
+            if (cpkg.upgrade != -1)
+            {
+                pkg->setUpgradePackage(cpkg.upgrade);
+            }
+            
+            d->cachedPackages.append(pkg);
+            rs->addPackage(pkg);
+        }
+        
+        return rs;
+    }
+    
+    // Les paquets ne sont créés qu'ici
+    foreach (Node *node, d->nodeList)
+    {
+        d->materialize(node);
+    }
+    
     // Explorer les noeuds
     for (int i=0; i<d->nodeList.count(); ++i)
     {
@@ -619,16 +927,39 @@ PackageList *Solver::list()
         }
     }
     
+    // Seuls les résultats sans choix de l'utilisateur peuvent être réutilisés
+    if (d->useCache && d->listEnded && !d->choicesMade && d->errorNode == 0)
+    {
+        d->writeCache(rs);
+    }
+    
     return rs;
 }
 
 Solver::Node *Solver::errorNode()
 {
+    // Créer les paquets de toute la chaîne d'erreurs
+    QSet<Node *> seen;
+    Node *node = d->errorNode;
+    
+    while (node != 0 && !seen.contains(node))
+    {
+        seen.insert(node);
+        d->materialize(node);
+        
+        node = (node->error != 0 ? node->error->other : 0);
+    }
+    
     return d->errorNode;
 }
 
 Solver::Node *Solver::choiceNode()
 {
+    if (d->choiceNode != 0)
+    {
+        d->materialize(d->choiceNode);
+    }
+    
     return d->choiceNode;
 }
 
@@ -672,19 +1003,19 @@ bool Solver::Private::verifyNode(Solver::Node *node, Solver::Error* &error)
     }
     
     // Explorer les noeuds déjà présents dans la liste
-    if (node->package)
+    if (node != rootNode)
     {
-        Solver::Action myAction = node->package->action();
+        Solver::Action myAction = node->action;
         
         foreach (Solver::Node *nd, nodeList)
         {
-            Solver::Action otherAction = nd->package->action();
+            Solver::Action otherAction = nd->action;
             
             if (nd == node) continue;
             
-            if (node->package->fastNameCompare(nd->package))
+            if (sameName(node, nd))
             {
-                if (node->package->fastVersionCompare(nd->package))
+                if (sameVersion(node, nd))
                 {
                     if (otherAction == myAction)
                     {
@@ -915,11 +1246,9 @@ bool Solver::Private::exploreNode(Solver::Node* node, bool& ended)
     return true;
 }
 
-bool Solver::Private::addNode(Package *package, Solver::Node *node)
+Solver::Node *Solver::Private::newNode(Package *package, int index, Solver::Action action)
 {
-    Solver::Action action = Solver::None;
-    
-    if (package) action = package->action();
+    Solver::Node *node = new Solver::Node;
     
     // Initialiser le noeud
     node->package = package;
@@ -930,6 +1259,11 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
     node->currentChild = 0;
     node->nodeListIndex = -1;
     
+    node->index = index;
+    node->action = action;
+    node->downloadSize = 0;
+    node->installSize = 0;
+    
     node->weight = 0;
     node->minWeight = 0;
     node->maxWeight = 0;
@@ -940,10 +1274,93 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
     
     node->weightedBy = 0;
     
+    // Les tailles sont lues une fois pour toutes, les paquets de la base de donnée
+    // n'étant créés qu'à la fin
+    if (index != -1)
+    {
+        _Package *mpkg = psd->package(index);
+        
+        if (mpkg != 0)
+        {
+            node->downloadSize = mpkg->dsize;
+            node->installSize = mpkg->isize;
+        }
+    }
+    else if (package != 0)
+    {
+        node->downloadSize = package->downloadSize();
+        node->installSize = package->installSize();
+    }
+    
     nodes.append(node);
     
+    return node;
+}
+
+int Solver::Private::nodeFlags(Solver::Node *node)
+{
+    if (node->index != -1)
+    {
+        _Package *mpkg = psd->package(node->index);
+        
+        return (mpkg != 0 ? mpkg->flags : 0);
+    }
+    else if (node->package != 0)
+    {
+        return node->package->flags();
+    }
+    
+    return 0;
+}
+
+bool Solver::Private::sameName(Solver::Node *a, Solver::Node *b)
+{
+    if (a->index != -1 && b->index != -1)
+    {
+        return (psd->package(a->index)->name == psd->package(b->index)->name);
+    }
+    
+    materialize(a);
+    materialize(b);
+    
+    return a->package->fastNameCompare(b->package);
+}
+
+bool Solver::Private::sameVersion(Solver::Node *a, Solver::Node *b)
+{
+    if (a->index != -1 && b->index != -1)
+    {
+        return (psd->package(a->index)->version == psd->package(b->index)->version);
+    }
+    
+    materialize(a);
+    materialize(b);
+    
+    return a->package->fastVersionCompare(b->package);
+}
+
+void Solver::Private::materialize(Solver::Node *node)
+{
+    if (node->package != 0 || node->index == -1)
+    {
+        return;
+    }
+    
+    DatabasePackage *package = new DatabasePackage(node->index, ps, psd, node->action);
+    package->setWanted((node->flags & Solver::Node::UserWanted) != 0);
+    
+    node->package = package;
+}
+
+bool Solver::Private::addNode(Solver::Node *node)
+{
+    Solver::Action action = node->action;
+    Package *package = node->package;
+    bool root = (node == rootNode);
+    _Package *mpkg = (node->index != -1 ? psd->package(node->index) : 0);
+    
     // Vérifier la validité du paquet
-    if (package && !package->isValid())
+    if (!root && mpkg == 0 && (package == 0 || !package->isValid()))
     {
         Solver::Error *err = new Solver::Error;
         err->type = Solver::Error::InternalError;
@@ -955,8 +1372,10 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
         return false;
     }
     
+    int flags = nodeFlags(node);
+    
     // Vérifier que ce qu'on demande est bon
-    if (package && ((package->flags() & Package::DontInstall) != 0) && action == Solver::Install)
+    if (!root && ((flags & Package::DontInstall) != 0) && action == Solver::Install)
     {
         Solver::Error *err = new Solver::Error;
         err->type = Solver::Error::UninstallablePackageInstalled;
@@ -967,7 +1386,7 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
         
         return false;
     }
-    else if (package && ((package->flags() & Package::DontRemove) != 0) && (action == Solver::Remove || action == Solver::Purge))
+    else if (!root && ((flags & Package::DontRemove) != 0) && (action == Solver::Remove || action == Solver::Purge))
     {
         Solver::Error *err = new Solver::Error;
         err->type = Solver::Error::UnremovablePackageRemoved;
@@ -980,11 +1399,11 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
     }
     
     // Vérifier que ce paquet est voulu, sauf si l'utilisateur veut qu'on ignore
-    if (useInstalled && package && package->origin() == Package::Database)
+    if (useInstalled && mpkg != 0)
     {
         if (
-            (((package->flags() & Package::Installed) != 0) && action == Solver::Install) ||
-            (((package->flags() & Package::Installed) == 0) && action != Solver::Install)
+            (((flags & Package::Installed) != 0) && action == Solver::Install) ||
+            (((flags & Package::Installed) == 0) && action != Solver::Install)
             )
         {
             node->flags &= ~Solver::Node::Wanted;
@@ -995,74 +1414,12 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
     // Node supplémentaire en cas de mise à jour
     Node *suppl = 0;
     
-    // Si on veut installer ce paquet, voir si on fini par une mise à jour
-    if (action == Solver::Install && package && package->origin() == Package::Database && useDeps)
-    {
-        // Paquet dans la base de donnée
-        DatabasePackage *dpkg = (DatabasePackage *)package;
-        int pindex = dpkg->index();
-        _Package *mpkg = psd->package(pindex);
-        
-        // Explorer les autres versions
-        QVector<int> otherVersions = psd->packagesOfString(0, mpkg->name, Depend::NoVersion);
-        
-        foreach(int otherVersion, otherVersions)
-        {
-            if (otherVersion == pindex)
-            {
-                // Ignorer ce paquet
-                continue;
-            }
-            
-            _Package *opkg = psd->package(otherVersion);
-            
-            // NOTE: le "&& opkg->name == mpkg->name" permet d'avoir deux paquets fournissant le même provide ensemble
-            if ((opkg->flags & Package::Installed) && opkg->version != mpkg->version && opkg->name == mpkg->name)
-            {
-                // Il va falloir supprimer ce paquet
-                bool ok = true;
-                suppl = checkPackage(otherVersion, Solver::Remove, ok, false);
-                
-                // Tout doit s'être bien passé
-                if (!ok)
-                {
-                    Solver::Error *err = new Solver::Error;
-                    err->type = Solver::Error::ChildError;
-                    err->other = suppl;
-                    
-                    node->error = err;
-                    errorNode = node;
-                    
-                    return false;
-                }
-                
-                // Vérifier que nd est updatable
-                if (suppl->package && ((suppl->package->flags() & Package::DontUpdate) != 0))
-                {
-                    Solver::Error *err = new Solver::Error;
-                    err->type = Solver::Error::UnupdatablePackageUpdated;
-                    err->other = suppl;
-                    
-                    node->error = err;
-                    errorNode = node;
-                    
-                    return false;
-                }
-                
-                // Paquet en plus à gérer
-                node->childcount++;
-                
-                // Une seule autre version
-                break;
-            }
-        }
-    }
-    
-    // Créer la liste des enfants
-    QVector<_Depend *> deps;
+    // Créer la liste des enfants. Pour un paquet de la base de donnée, expand() fait
+    // la même énumération avec updatedVersion() et dependChildren()
+    QVector<DependChild> dchildren;
     QVector<Depend *> fdeps;
     
-    if (package == 0)
+    if (root)
     {
         node->childcount = wantedPackages.count();
     }
@@ -1071,45 +1428,60 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
         // On ne gère pas les dépendances
         return true;
     }
-    else if (package->origin() == Package::Database)
+    else if (mpkg != 0)
     {
-        deps = psd->depends(((DatabasePackage *)package)->index());
+        QVector<int> versions = namePackages(mpkg->name);
         
-        // Explorer ces dépendances pour savoir combien d'enfants il faut
-        foreach (_Depend *dep, deps)
+        // Si on veut installer ce paquet, voir si on fini par une mise à jour
+        int otherVersion = updatedVersion(node->index, mpkg, action, versions);
+        
+        if (otherVersion != -1)
         {
-            if ((dep->type == Depend::DependType && action == Solver::Install) ||
-                (dep->type == Depend::Suggest && action == Solver::Install && installSuggests))
-            {
-                node->childcount++;
-            }
-            else if ((dep->type == Depend::Conflict || dep->type == Depend::Replace) && action == Solver::Install)
+            // Il va falloir supprimer ce paquet
+            bool ok = true;
+            suppl = checkPackage(otherVersion, Solver::Remove, ok, false);
+            
+            // Tout doit s'être bien passé
+            if (!ok)
             {
-                node->childcount++;
+                Solver::Error *err = new Solver::Error;
+                err->type = Solver::Error::ChildError;
+                err->other = suppl;
+                
+                node->error = err;
+                errorNode = node;
+                
+                return false;
             }
-            else if (dep->type == Depend::RevDep && action == Solver::Remove)
+            
+            // Vérifier que nd est updatable
+            if ((nodeFlags(suppl) & Package::DontUpdate) != 0)
             {
-                node->childcount++;
+                Solver::Error *err = new Solver::Error;
+                err->type = Solver::Error::UnupdatablePackageUpdated;
+                err->other = suppl;
+                
+                node->error = err;
+                errorNode = node;
+                
+                return false;
             }
+            
+            // Paquet en plus à gérer
+            node->childcount++;
         }
+        
+        dchildren = dependChildren(node->index, action, versions);
+        node->childcount += dchildren.count();
     }
     else
     {
-        // Paquet fichier
+        // Paquet fichier, qu'on ne peut qu'installer : il n'a pas de revdeps
         fdeps = package->depends();
         
         foreach(Depend *dep, fdeps)
         {
-            if ((dep->type() == Depend::DependType && action == Solver::Install) ||
-                (dep->type() == Depend::Suggest && action == Solver::Install && installSuggests))
-            {
-                node->childcount++;
-            }
-            else if ((dep->type() == Depend::Conflict || dep->type() == Depend::Replace) && action == Solver::Install)
-            {
-                node->childcount++;
-            }
-            else if (dep->type() == Depend::RevDep && action == Solver::Remove)
+            if (dep->type() != Depend::RevDep && dependAction(dep->type(), action, installSuggests) != Solver::None)
             {
                 node->childcount++;
             }
@@ -1129,7 +1501,7 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
     // Ajouter les enfants
     for (int i=0, di=0; i<node->childcount; ++i, ++di)
     {
-        if (package == 0)
+        if (root)
         {
             const WantedPackage &wp = wantedPackages.at(i);
             
@@ -1140,13 +1512,14 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
                 fpkg->setWanted(true); // Demandé par l'utilisateur
                 
                 // Nouveau Node pour ce paquet
-                Node *nd = new Node;
+                Node *nd = newNode(fpkg, -1, Solver::Install);
+                nd->flags |= Node::UserWanted;
                 
                 // Enregistrer ce noeud
                 children[i].count = 1;
                 children[i].node = nd;
                 
-                if (!addNode(fpkg, nd))
+                if (!addNode(nd))
                 {
                     Solver::Error *err = new Solver::Error;
                     err->type = Solver::Error::ChildError;
@@ -1186,10 +1559,10 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
         }
         else
         {
-            Solver::Action act = Solver::None;
-            _Depend *ddep;
-            Depend *fdep;
-            int dtype;
+            Solver::Action act;
+            QVector<int> pkgIndexes;
+            QString pattern;
+            bool revdep = false;
             
             if (i == (node->childcount - 1) && suppl)
             {
@@ -1203,80 +1576,39 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
                 break;
             }
             
-            // Type de la dépendance en fonction de l'origine du paquet
-            if (package->origin() == Package::Database)
-            {
-                ddep = deps.at(di);
-                dtype = ddep->type;
-            }
-            else
+            // Paquets de l'enfant en fonction de l'origine du paquet
+            if (mpkg != 0)
             {
-                fdep = fdeps.at(di);
-                dtype = fdep->type();
-            }
-            
-            // Trouver l'action
-            if ((dtype == Depend::DependType && action == Solver::Install) ||
-                (dtype == Depend::Suggest && action == Solver::Install && installSuggests))
-            {
-                act = Solver::Install;
-            }
-            else if ((dtype == Depend::Conflict || dtype == Depend::Replace) && action == Solver::Install)
-            {
-                act = Solver::Remove;
-            }
-            else if (dtype == Depend::RevDep && action == Solver::Remove)
-            {
-                // Créer plusieurs noeuds pour cet enfant : un pour supprimer cette revdep, un pour chaque provide
-                // qu'on peut installer à la place.
-                QVector<int> pkgIndexes;
+                const DependChild &dchild = dchildren.at(di);
                 
-                // ddep->pkgname = index du paquet
-                pkgIndexes.append(ddep->pkgname);
+                act = dchild.action;
+                revdep = dchild.revdep;
+                pkgIndexes = dchild.pkgIndexes;
                 
-                // Paquet dans la base de donnée
-                DatabasePackage *dpkg = (DatabasePackage *)package;
-                int pindex = dpkg->index();
-                _Package *mpkg = psd->package(pindex);
-                
-                // Ajouter à pkgIndexes les index des provides de ce paquet
-                foreach(int pkgIndex, psd->packagesOfString(0, mpkg->name, Depend::NoVersion))
+                if (pkgIndexes.count() == 0)
                 {
-                    if (pkgIndex != pindex)
-                    {
-                        pkgIndexes.append(pkgIndex);
-                    }
+                    pattern = PackageSystem::dependString(
+                                psd->string(false, dchild.dep->pkgname),
+                                psd->string(false, dchild.dep->pkgver),
+                                (Depend::Operation)dchild.dep->op);
                 }
+            }
+            else
+            {
+                Depend *fdep = fdeps.at(di);
                 
-                // Ajouter les paquets
-                if (!addPkgs(pkgIndexes, node, Solver::Install, &children[i], true))
+                act = (fdep->type() != Depend::RevDep ? dependAction(fdep->type(), action, installSuggests) : Solver::None);
+                
+                if (act == Solver::None)
                 {
-                    // addPkgs s'occupe de l'erreur
-                    return false;
+                    // Rien à faire. Décrémenter i pour ne pas sortir du tableau children, laisser
+                    // di comme il est car il sert à récupérer la dépendance suivante.
+                    i--;
+                    continue;
                 }
                 
-                // On a géré les revdeps, on a fini
-                continue;
-            }
-            
-            if (act == Solver::None)
-            {
-                // Rien à faire. Décrémenter i pour ne pas sortir du tableau children, laisser
-                // di comme il est car il sert à récupérer la dépendance suivante.
-                i--;
-                continue;
-            }
-            
-            QVector<int> pkgIndexes;
-            
-            // Trouver les indexes des paquets à installer en fonction de l'origine du paquet
-            if (package->origin() == Package::Database)
-            {
-                pkgIndexes = psd->packagesOfString(ddep->pkgver, ddep->pkgname, (Depend::Operation)ddep->op);
-            }
-            else
-            {
                 pkgIndexes = psd->packagesByVString(fdep->name(), fdep->version(), fdep->op());
+                pattern = PackageSystem::dependString(fdep->name(), fdep->version(), fdep->op());
             }
             
             // Dépendre de paquets qui n'existent pas n'est pas bon
@@ -1285,16 +1617,8 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
                 Solver::Error *err = new Solver::Error;
                 err->type = Solver::Error::NoDeps;
                 err->other = 0;
-                err->pattern = (package->origin() == Package::Database ?
-                                    PackageSystem::dependString(
-                                    psd->string(false, ddep->pkgname),
-                                    psd->string(false, ddep->pkgver),
-                                    (Depend::Operation)ddep->op)
-                                :   PackageSystem::dependString(
-                                    fdep->name(), 
-                                    fdep->version(), 
-                                    fdep->op()));
-                                    
+                err->pattern = pattern;
+                
                 node->error = err;
                 errorNode = node;
                 
@@ -1302,7 +1626,7 @@ bool Solver::Private::addNode(Package *package, Solver::Node *node)
             }
             
             // Ajouter les paquets
-            if (!addPkgs(pkgIndexes, node, act, &children[i]))
+            if (!addPkgs(pkgIndexes, node, act, &children[i], revdep))
             {
                 // addPkgs s'occupe de l'erreur
                 return false;
@@ -1319,7 +1643,7 @@ bool Solver::Private::addPkgs(const QVector<int> &pkgIndexes, Solver::Node *node
     if (pkgIndexes.count() == 1)
     {
         bool ok = true;
-        Node *nd = checkPackage(pkgIndexes.at(0), (revdep ? Solver::Remove : action), ok, (node->package == 0));
+        Node *nd = checkPackage(pkgIndexes.at(0), childAction(action, revdep, 0), ok, (node == rootNode));
         
         // Enregistrer le noeud
         child->count = 1;
@@ -1355,7 +1679,7 @@ bool Solver::Private::addPkgs(const QVector<int> &pkgIndexes, Solver::Node *node
             int pkgIndex = pkgIndexes.at(j);
             
             bool ok = true;
-            Node *nd = checkPackage(pkgIndex, (revdep && j == 0 ? Solver::Remove : action), ok, (node->package == 0));
+            Node *nd = checkPackage(pkgIndex, childAction(action, revdep, j), ok, (node == rootNode));
             
             // Enregistrer le noeud
             nodes[j] = nd;
@@ -1385,29 +1709,374 @@ bool Solver::Private::addPkgs(const QVector<int> &pkgIndexes, Solver::Node *node
     return true;
 }
 
-Solver::Node *Solver::Private::checkPackage(int index, Solver::Action action, bool &ok, bool userWanted)
+bool Solver::Private::readCache()
 {
-    // Explorer tous les noeuds à la recherche d'un éventuel qui correspondrait à l'index et à l'action
-    for (int i=0; i<nodes.count(); ++i)
+    // Clef : demande normalisée et options du Solver
+    QStringList request;
+    
+    foreach (const WantedPackage &wp, wantedPackages)
     {
-        Solver::Node *node = nodes.at(i);
+        if (wp.pattern.endsWith(".lpk"))
+        {
+            // Le contenu du fichier peut changer
+            return false;
+        }
         
-        if (node->package && node->package->action() == action && node->package->origin() == Package::Database && ((DatabasePackage *)node->package)->index() == index)
+        request.append(QString::number(wp.action) + ' ' + wp.pattern);
+    }
+    
+    request.sort();
+    request.append(QString("%1 %2 %3").arg(useDeps).arg(useInstalled).arg(installSuggests));
+    
+    QByteArray key = QCryptographicHash::hash(request.join("\n").toUtf8(), QCryptographicHash::Sha1).toHex();
+    
+    cacheFile = ps->varRoot() + "/var/cache/lgrpkg/db/solver/" + key;
+    generation = psd->generation();
+    
+    QFile fl(cacheFile);
+    
+    if (!fl.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    
+    // Première ligne : génération de la base de donnée, puis un paquet par ligne,
+    // et enfin "end <nombre de paquets>"
+    if (fl.readLine().trimmed() != generation)
+    {
+        return false;
+    }
+    
+    cachedList.clear();
+    
+    while (!fl.atEnd())
+    {
+        QList<QByteArray> parts = fl.readLine().trimmed().split(' ');
+        
+        if (parts.count() == 2 && parts.at(0) == "end")
         {
-            // Le noeud existe déjà, le retourner
-            ok = (node->error == 0);
-            if (userWanted) node->package->setWanted(true);
+            if (parts.at(1).toInt() == cachedList.count())
+            {
+                return true;
+            }
             
-            return node;
+            break;
+        }
+        
+        if (parts.count() != 4)
+        {
+            break;
+        }
+        
+        CachedPackage cpkg;
+        
+        cpkg.index = parts.at(0).toInt();
+        cpkg.action = (Solver::Action)parts.at(1).toInt();
+        cpkg.upgrade = parts.at(2).toInt();
+        cpkg.wanted = (parts.at(3) == "1");
+        
+        cachedList.append(cpkg);
+    }
+    
+    // Fichier tronqué ou abîmé, le résultat sera recalculé
+    cachedList.clear();
+    
+    return false;
+}
+
+void Solver::Private::writeCache(PackageList *list)
+{
+    if (cacheFile.isEmpty())
+    {
+        return;
+    }
+    
+    QByteArray data = generation + '\n';
+    
+    foreach (Package *pkg, *list)
+    {
+        if (pkg->origin() != Package::Database)
+        {
+            return;
         }
+        
+        DatabasePackage *upd = (pkg->action() == Solver::Update ? pkg->upgradePackage() : 0);
+        
+        data += QByteArray::number(((DatabasePackage *)pkg)->index()) + ' ' +
+                QByteArray::number(pkg->action()) + ' ' +
+                QByteArray::number(upd != 0 ? upd->index() : -1) + ' ' +
+                (pkg->wanted() ? "1" : "0") + '\n';
     }
     
-    // Pas de noeud correspondant trouvé
-    DatabasePackage *package = new DatabasePackage(index, ps, psd, action);
-    package->setWanted(userWanted);     // Savoir si c'est un paquet explicitement demandé par l'utilisateur
+    data += "end " + QByteArray::number(list->count()) + '\n';
     
-    Solver::Node *node = new Solver::Node;
-    ok = addNode(package, node);
+    // Le cache est facultatif, les erreurs sont ignorées. Fichier temporaire puis
+    // renommage : un autre processus peut lire le cache pendant ce temps
+    QDir().mkpath(cacheFile.section('/', 0, -2));
+    
+    QTemporaryFile fl(cacheFile + ".XXXXXX");
+    
+    if (!fl.open() || fl.write(data) != data.size())
+    {
+        return;
+    }
+    
+    fl.setAutoRemove(false);
+    fl.close();
+    
+    QFile::remove(cacheFile);
+    
+    if (!fl.rename(cacheFile))
+    {
+        fl.remove();
+    }
+}
+
+QVector<int> Solver::Private::dependPackages(_Depend *dep)
+{
+    QHash<_Depend *, QVector<int> >::const_iterator it = dependPackagesCache.constFind(dep);
+    
+    if (it != dependPackagesCache.constEnd())
+    {
+        return it.value();
+    }
+    
+    return psd->packagesOfString(dep->pkgver, dep->pkgname, (Depend::Operation)dep->op);
+}
+
+QVector<int> Solver::Private::namePackages(int name)
+{
+    QHash<int, QVector<int> >::const_iterator it = namePackagesCache.constFind(name);
+    
+    if (it != namePackagesCache.constEnd())
+    {
+        return it.value();
+    }
+    
+    return psd->packagesOfString(0, name, Depend::NoVersion);
+}
+
+int Solver::Private::updatedVersion(int index, _Package *mpkg, Solver::Action action, const QVector<int> &versions)
+{
+    // Installer un paquet met à jour son autre version installée, s'il y en a une
+    if (action != Solver::Install)
+    {
+        return -1;
+    }
+    
+    foreach(int otherVersion, versions)
+    {
+        if (otherVersion == index)
+        {
+            // Ignorer ce paquet
+            continue;
+        }
+        
+        _Package *opkg = psd->package(otherVersion);
+        
+        // NOTE: le "&& opkg->name == mpkg->name" permet d'avoir deux paquets fournissant le même provide ensemble
+        if ((opkg->flags & Package::Installed) && opkg->version != mpkg->version && opkg->name == mpkg->name)
+        {
+            // Une seule autre version
+            return otherVersion;
+        }
+    }
+    
+    return -1;
+}
+
+QVector<Solver::Private::DependChild> Solver::Private::dependChildren(int index, Solver::Action action, const QVector<int> &versions)
+{
+    // Appelé par addNode() et expand() (en parallèle) : ne fait que lire la base de donnée et les caches
+    QVector<DependChild> rs;
+    
+    foreach (_Depend *dep, psd->depends(index))
+    {
+        DependChild dchild;
+        
+        dchild.dep = dep;
+        dchild.action = dependAction(dep->type, action, installSuggests);
+        dchild.revdep = (dep->type == Depend::RevDep);
+        
+        if (dchild.action == Solver::None)
+        {
+            continue;
+        }
+        
+        if (dchild.revdep)
+        {
+            // Un noeud pour supprimer cette revdep (dep->pkgname = index du paquet), un pour
+            // chaque provide qu'on peut installer à la place.
+            dchild.pkgIndexes.append(dep->pkgname);
+            
+            foreach(int pkgIndex, versions)
+            {
+                if (pkgIndex != index)
+                {
+                    dchild.pkgIndexes.append(pkgIndex);
+                }
+            }
+        }
+        else
+        {
+            dchild.pkgIndexes = dependPackages(dep);
+        }
+        
+        rs.append(dchild);
+    }
+    
+    return rs;
+}
+
+Solver::Private::Expansion Solver::Private::expand(qint64 key)
+{
+    // Appelé dans un thread du QThreadPool : ne fait que lire la base de donnée, en
+    // prenant les décisions de addNode() qui ne dépendent que du paquet lui-même.
+    Expansion rs;
+    int index = (int)(key >> 3);
+    Solver::Action action = (Solver::Action)(key & 7);
+    _Package *mpkg = psd->package(index);
+    
+    rs.name = -1;
+    
+    if (mpkg == 0)
+    {
+        return rs;
+    }
+    
+    // Erreurs, addNode() n'ira pas plus loin
+    if (((mpkg->flags & Package::DontInstall) != 0 && action == Solver::Install) ||
+        ((mpkg->flags & Package::DontRemove) != 0 && (action == Solver::Remove || action == Solver::Purge)))
+    {
+        return rs;
+    }
+    
+    // Noeuds non-voulus
+    if (useInstalled &&
+        ((((mpkg->flags & Package::Installed) != 0) && action == Solver::Install) ||
+         (((mpkg->flags & Package::Installed) == 0) && action != Solver::Install)))
+    {
+        return rs;
+    }
+    
+    if (!useDeps)
+    {
+        return rs;
+    }
+    
+    // Mêmes enfants que addNode() : autres versions, pour les mises à jour et les revdeps
+    rs.name = mpkg->name;
+    rs.versions = namePackages(mpkg->name);
+    
+    int otherVersion = updatedVersion(index, mpkg, action, rs.versions);
+    
+    if (otherVersion != -1)
+    {
+        rs.children.append(nodeKey(otherVersion, Solver::Remove));
+    }
+    
+    // Dépendances
+    foreach (const DependChild &dchild, dependChildren(index, action, rs.versions))
+    {
+        for (int j=0; j<dchild.pkgIndexes.count(); ++j)
+        {
+            rs.children.append(nodeKey(dchild.pkgIndexes.at(j), childAction(dchild.action, dchild.revdep, j)));
+        }
+        
+        if (!dchild.revdep)
+        {
+            rs.depends.append(qMakePair(dchild.dep, dchild.pkgIndexes));
+        }
+    }
+    
+    return rs;
+}
+
+void Solver::Private::prefetch()
+{
+    // Parcours en largeur, niveau par niveau : les paquets d'un niveau sont développés
+    // en parallèle, puis les résultats sont fusionnés dans l'ordre. addNode() construit
+    // ensuite l'arbre comme d'habitude, mais sans refaire les recherches.
+    QSet<qint64> seen;
+    QVector<qint64> level;
+    
+    foreach (const WantedPackage &wp, wantedPackages)
+    {
+        if (wp.pattern.endsWith(".lpk"))
+        {
+            continue;
+        }
+        
+        foreach (int pkgIndex, psd->packagesByVString(wp.pattern))
+        {
+            qint64 key = nodeKey(pkgIndex, wp.action);
+            
+            if (!seen.contains(key))
+            {
+                seen.insert(key);
+                level.append(key);
+            }
+        }
+    }
+    
+    while (level.count() != 0)
+    {
+        QList<Expansion> expansions = QtConcurrent::blockingMapped<QList<Expansion> >(level, Expander(this));
+        
+        level.clear();
+        
+        foreach (const Expansion &expansion, expansions)
+        {
+            for (int i=0; i<expansion.depends.count(); ++i)
+            {
+                dependPackagesCache.insert(expansion.depends.at(i).first, expansion.depends.at(i).second);
+            }
+            
+            if (expansion.name != -1)
+            {
+                namePackagesCache.insert(expansion.name, expansion.versions);
+            }
+            
+            foreach (qint64 key, expansion.children)
+            {
+                if (!seen.contains(key))
+                {
+                    seen.insert(key);
+                    level.append(key);
+                }
+            }
+        }
+    }
+}
+
+Solver::Node *Solver::Private::checkPackage(int index, Solver::Action action, bool &ok, bool userWanted)
+{
+    // Chercher un noeud existant pour cet index et cette action
+    qint64 key = nodeKey(index, action);
+    Solver::Node *node = databaseNodes.value(key);
+    
+    if (node != 0)
+    {
+        // Le noeud existe déjà, le retourner
+        ok = (node->error == 0);
+        
+        if (userWanted)
+        {
+            node->flags |= Solver::Node::UserWanted;
+            if (node->package) node->package->setWanted(true);
+        }
+        
+        return node;
+    }
+    
+    // Pas de noeud correspondant trouvé. Le paquet lui-même n'est créé que quand le noeud sort du Solver
+    node = newNode(0, index, action);
+    databaseNodes.insert(key, node);
+    
+    // Savoir si c'est un paquet explicitement demandé par l'utilisateur
+    if (userWanted) node->flags |= Solver::Node::UserWanted;
+    
+    ok = addNode(node);
     
     return node;
 }
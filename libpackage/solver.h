@@ -143,19 +143,25 @@ class Solver : public QObject
             {
                 None = 0,               /*!< @brief Pas de flag */
                 Wanted = 1,             /*!< @brief Paquet voulu, par exemple pas encore installé mais qu'on veut installer. Pas interne */
-                Weighted = 2,           /*!< @brief Paquet pesé par le script QtScript */
+                Weighted = 2,           /*!< @brief Paquet pesé par weight.conf ou le script QtScript */
                 Proceed = 4,            /*!< @brief Inutilisé */
                 MinMaxWeighted = 8,     /*!< @brief Protection de minMaxWeight */
                 WeightMin = 16,         /*!< @brief Utilisé par weightChildren */
                 MinMaxDone = 32,        /*!< @brief Protection de weightChildren */
                 BeingExplored = 64,     /*!< @brief Utilisé par exploreNode */
                 Explored = 128,         /*!< @brief Exploration terminée */
+                UserWanted = 256,       /*!< @brief Paquet explicitement demandé par l'utilisateur */
             };
             
             Q_DECLARE_FLAGS(Flags, Flag)
             
-            Package *package;                   /*!< @brief Paquet, 0 si noeud principal (racine) */
+            Package *package;                   /*!< @brief Paquet, 0 si noeud principal (racine). Toujours présent dans les noeuds renvoyés par le Solver */
             Flags flags;                        /*!< @brief Flags */
+            
+            int index;                          /*!< @brief Index du paquet dans la base de donnée, -1 pour la racine et les paquets fichiers. @internal */
+            Action action;                      /*!< @brief Action voulue pour le paquet. @internal */
+            int downloadSize;                   /*!< @brief Taille de téléchargement du paquet. @internal */
+            int installSize;                    /*!< @brief Taille installée du paquet. @internal */
             Error *error;                       /*!< @brief Erreur, 0 si pas d'erreur */
             
             int minWeight;                      /*!< @brief Poids minimum */
@@ -224,6 +230,11 @@ class Solver : public QObject
          * Appelé normalement juste après solve(), pèse l'arbre contruit par
          * solve().
          * 
+         * Les poids sont calculés par la politique déclarative
+         * /etc/lgrpkg/scripts/weight.conf, lue une seule fois par processus.
+         * Le script /etc/lgrpkg/scripts/weight.qs n'est utilisé que si elle
+         * n'existe pas, ou si sa clef Script vaut true.
+         * 
          * @return True si tout s'est bien passé, false sinon. errorNode() est placé correctement.
          */
         bool weight();
@@ -339,8 +350,31 @@ class Solver : public QObject
          * @brief Définit si les paquets suggérés par ceux que l'utilisateur veut (pas leurs dépendances) doivent être installés
          */
         void setInstallSuggests(bool enable);
+        
+        /**
+         * @brief Définit si solve() développe l'arbre en parallèle (@b true par défaut)
+         * 
+         * Les recherches dans la base de donnée des branches indépendantes de l'arbre
+         * sont faites sur plusieurs processeurs avant la construction de l'arbre. Les
+         * choix et les erreurs sont les mêmes qu'en mode séquentiel.
+         */
+        void setParallelExpansion(bool enable);
+        
+        /**
+         * @brief Définit si les résultats sont gardés dans /var/cache/lgrpkg/db/solver (@b false par défaut)
+         * 
+         * Une liste obtenue sans choix de l'utilisateur est enregistrée avec la
+         * demande, les options du Solver et la génération de la base de donnée
+         * (DatabaseReader::generation()). Si la même demande est refaite sur une
+         * base de donnée inchangée, solve() ne construit pas l'arbre et list()
+         * renvoie directement le résultat. root() est alors un noeud sans enfants :
+         * n'activez le cache que si seule la liste des paquets est utilisée.
+         */
+        void setUseCache(bool enable);
 
     private:
+        bool scriptWeight();
+        
         struct Private;
         Private *d;
 };
@@ -22,113 +22,183 @@
 
 #include "templatable.h"
 
-#include <QList>
+#include <QHash>
+#include <QVector>
 
 using namespace Logram;
 
+// Nombre maximal de templates compilées gardées en cache
+#define TEMPLATE_CACHE_SIZE 256
+
+// Les templates plus longues (scripts) sont compilées à chaque fois
+#define TEMPLATE_CACHE_MAXLENGTH 1024
+
+// Profondeur maximale de remplacement des clefs par des clefs
+#define TEMPLATE_MAX_DEPTH 16
+
 struct Templatable::Private
 {
-    struct Entry
+    // Morceau d'une template : texte littéral ou nom d'une clef
+    struct Segment
     {
-        QString key;
-        QString value;
+        bool key;
+        QString text;
     };
     
-    QList<Entry> entries;
+    typedef QVector<Segment> Compiled;
+    
+    QHash<QString, QString> values;
+    mutable QHash<QString, Compiled> cache;
+    
+    Compiled compiled(const QString &tpl) const;
+    void render(const QString &tpl, QString &rs, int depth) const;
 };
 
-Templatable::Templatable(QObject *parent) : QObject(parent)
-{
-    d = new Private;
-}
-
-Templatable::~Templatable()
+Templatable::Private::Compiled Templatable::Private::compiled(const QString &tpl) const
 {
-    delete d;
-}
-        
-void Templatable::addKey(const QString &key, const QString &value)
-{
-    for (int i=0; i<d->entries.count(); ++i)
+    bool cacheable = (tpl.length() <= TEMPLATE_CACHE_MAXLENGTH);
+    
+    if (cacheable)
     {
-        Private::Entry &entry = d->entries[i];
+        QHash<QString, Compiled>::const_iterator it = cache.constFind(tpl);
         
-        if (entry.key == key)
+        if (it != cache.constEnd())
         {
-            entry.value = value;
-            return;
+            return it.value();
         }
     }
     
-    Private::Entry entry;
-    
-    entry.key = key;
-    entry.value = value;
+    // Découper tpl en morceaux littéraux et en {{clef}}
+    Compiled rs;
+    Segment segment;
+    int pos = 0;
     
-    d->entries.append(entry);
-}
-
-void Templatable::removeKey(const QString &key)
-{
-    for (int i=0; i<d->entries.count(); ++i)
+    while (pos < tpl.length())
     {
-        const Private::Entry &entry = d->entries.at(i);
+        int start = tpl.indexOf("{{", pos);
+        int end = (start == -1 ? -1 : tpl.indexOf("}}", start + 2));
         
-        if (entry.key == key)
+        if (end == -1)
         {
-            d->entries.removeAt(i);
-            return;
+            // Plus de clef, le reste est littéral
+            segment.key = false;
+            segment.text = tpl.mid(pos);
+            rs.append(segment);
+            break;
         }
+        
+        if (start != pos)
+        {
+            segment.key = false;
+            segment.text = tpl.mid(pos, start - pos);
+            rs.append(segment);
+        }
+        
+        segment.key = true;
+        segment.text = tpl.mid(start + 2, end - start - 2);
+        rs.append(segment);
+        
+        pos = end + 2;
     }
-}
-
-QString Templatable::getKey(const QString &key) const
-{
-    foreach (const Private::Entry &entry, d->entries)
+    
+    if (cacheable)
     {
-        if (entry.key == key)
+        if (cache.count() >= TEMPLATE_CACHE_SIZE)
         {
-            return entry.value;
+            cache.clear();
         }
+        
+        cache.insert(tpl, rs);
     }
     
-    return QString();
+    return rs;
 }
 
-bool Templatable::contains(const QString &key) const
+void Templatable::Private::render(const QString &tpl, QString &rs, int depth) const
 {
-    foreach (const Private::Entry &entry, d->entries)
+    Compiled segments = compiled(tpl);
+    
+    for (int i=0; i<segments.count(); ++i)
     {
-        if (entry.key == key)
+        const Segment &segment = segments.at(i);
+        
+        if (!segment.key)
+        {
+            rs += segment.text;
+            continue;
+        }
+        
+        QHash<QString, QString>::const_iterator it = values.constFind(segment.text);
+        
+        if (it == values.constEnd())
         {
-            return true;
+            // Clef inconnue, laissée telle quelle
+            rs += "{{" + segment.text + "}}";
+        }
+        else if (depth < TEMPLATE_MAX_DEPTH && it.value().contains("{{"))
+        {
+            // Permettre de remplacer des clefs par des clefs
+            render(it.value(), rs, depth + 1);
+        }
+        else
+        {
+            rs += it.value();
         }
     }
-    
-    return false;
+}
+
+Templatable::Templatable(QObject *parent) : QObject(parent)
+{
+    d = new Private;
+}
+
+Templatable::~Templatable()
+{
+    delete d;
+}
+        
+void Templatable::addKey(const QString &key, const QString &value)
+{
+    d->values.insert(key, value);
+}
+
+void Templatable::removeKey(const QString &key)
+{
+    d->values.remove(key);
+}
+
+QString Templatable::getKey(const QString &key) const
+{
+    return d->values.value(key);
+}
+
+bool Templatable::contains(const QString &key) const
+{
+    return d->values.contains(key);
 }
         
 QString Templatable::templateString(const QString &tpl) const
 {
-    // Explorer les clefs et remplacer le motif {{clef}} dans tpl par la valeur de la clef
-    QString rs = tpl;
-    
-    for (int i=0; i<d->entries.count(); ++i)
+    if (!tpl.contains("{{"))
     {
-        const Private::Entry &entry = d->entries.at(i);
-        QString mkey = "{{" + entry.key + "}}";
-        
-        if (rs.contains(mkey))
-        {
-            rs.replace(mkey, entry.value);
-            i = 0;  // Reboucler, pour permettre de remplacer des clefs par des clefs
-        }
+        return tpl;
     }
     
+    // Une seule passe sur les morceaux de la template
+    QString rs;
+    
+    rs.reserve(tpl.length());
+    d->render(tpl, rs, 0);
+    
     return rs;
 }
 
 QByteArray Templatable::templateString(const QByteArray &tpl) const
 {
+    if (!tpl.contains("{{"))
+    {
+        return tpl;
+    }
+    
     return templateString(QString(tpl)).toUtf8();
-}
\ No newline at end of file
+}
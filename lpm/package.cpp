@@ -40,6 +40,9 @@ void App::add(const QStringList &packages)
     solver->setUseInstalled(useInstalled);
     solver->setInstallSuggests(installSuggests);
     
+    // L'arbre des dépendances n'est pas gardé en cache, seulement la liste
+    solver->setUseCache(!depsTree);
+    
     foreach(const QString &package, packages)
     {
         QString name = package;
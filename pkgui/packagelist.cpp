@@ -137,7 +137,12 @@ void MainWindow::searchPackages()
     }
     
     // Trouver les IDs en fonction de ce qu'on demande
-    if (regex.isEmpty())
+    if (regex.isEmpty() && (filter == FilterInterface::Installed || filter == FilterInterface::NotInstalled))
+    {
+        // Seulement les paquets installés ou non, la base de donnée les trouve directement
+        ids = dr->packagesWithFlags(Package::Installed, (filter == FilterInterface::Installed ? Package::Installed : 0));
+    }
+    else if (regex.isEmpty())
     {
         // Tous les paquets
         int tot = ps->packages();